@@ -0,0 +1,365 @@
+#include <spdlog/spdlog.h>
+#include "BenchClient.hpp"
+#include "Rtmp.hpp"
+
+namespace ms777::bench {
+constexpr uint32_t AUDIO_FRAME_SAMPLES = 1024;
+constexpr uint32_t AUDIO_SAMPLE_RATE = 44100;
+constexpr uint32_t VIDEO_TAG_HEADER_SIZE = 5;
+constexpr uint32_t AUDIO_TAG_HEADER_SIZE = 2;
+constexpr uint32_t STAMP_SIZE = 8;
+constexpr uint32_t READ_SIZE = 65536;
+// AVCDecoderConfigurationRecord with a dummy SPS and PPS
+constexpr uint8_t VIDEO_CONFIG[] = {
+    0x17, 0, 0, 0, 0, 1, 0x64, 0, 0x1f, 0xff, 0xe1, 0, 4, 0x67, 0x64, 0, 0x1f, 1, 0, 2, 0x68, 0xee
+};
+// AudioSpecificConfig, AAC LC 44.1 kHz stereo
+constexpr uint8_t AUDIO_CONFIG[] = { 0xaf, 0, 0x12, 0x10 };
+
+std::atomic<bool> BenchClient::measuring{ false };
+
+static inline uint64_t nowNanos()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>
+           (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+BenchClient::BenchClient(boost::asio::io_context &io, Role role, const std::string &app, const std::string &name,
+                         const Pattern &pattern)
+    : socket_(io),
+      timer_(io),
+      role_(role),
+      app_(app),
+      name_(name),
+      pattern_(pattern),
+      in_(READ_SIZE),
+      out_(READ_SIZE),
+      pending_(READ_SIZE)
+{
+}
+
+void BenchClient::start(const boost::asio::ip::tcp::endpoint &endpoint)
+{
+    tcUrl_ = "rtmp://" + endpoint.address().to_string() + ":" + std::to_string(endpoint.port()) + "/" + app_;
+    auto self(shared_from_this());
+    socket_.async_connect(endpoint, [this, self](const boost::system::error_code & ec) {
+        if(ec) {
+            fail("connect");
+            return;
+        }
+        socket_.set_option(boost::asio::ip::tcp::no_delay(true));
+        doHandshake();
+    });
+}
+
+void BenchClient::stop()
+{
+    stopped_ = true;
+    timer_.cancel();
+    boost::system::error_code ec;
+    socket_.close(ec);
+}
+
+void BenchClient::fail(const char *what)
+{
+    if(!stopped_) {
+        SPDLOG_ERROR("Bench client {}, {} failed for {}/{}", (void *)this, what, app_, name_);
+        failed_ = true;
+        stop();
+    }
+}
+
+void BenchClient::doHandshake()
+{
+    // C0 C1 out, S0 S1 S2 back, then C2 echoes S1
+    handshake_.assign(1 + 2 * rtmp::HANDSHAKE_SIZE, 0);
+    handshake_[0] = rtmp::HANDSHAKE_VERSION;
+    auto self(shared_from_this());
+    boost::asio::async_write(socket_, boost::asio::buffer(handshake_.data(), 1 + rtmp::HANDSHAKE_SIZE),
+    [this, self](const boost::system::error_code & ec, std::size_t n) {
+        if(ec) {
+            fail("handshake");
+            return;
+        }
+        bytesOut_.add(n);
+        boost::asio::async_read(socket_, boost::asio::buffer(handshake_.data(), 1 + 2 * rtmp::HANDSHAKE_SIZE),
+        [this, self](const boost::system::error_code & ec, std::size_t n) {
+            if(ec) {
+                fail("handshake");
+                return;
+            }
+            bytesIn_.add(n);
+            pending_.append(handshake_.data() + 1, rtmp::HANDSHAKE_SIZE);
+            rtmp::MessageEncoder(pending_, rtmp::DEFAULT_CHUNK_SIZE).encodeSetChunkSize(outChunkSize_);
+            rtmp::MessageEncoder(pending_, outChunkSize_).encodeConnect(app_.c_str(), "", tcUrl_.c_str(),
+                    rtmp::TRANSACTION_ID_CLIENT_CONNECT);
+            flush();
+            doRead();
+        });
+    });
+}
+
+void BenchClient::doRead()
+{
+    // room for a whole chunk, chunks are only decoded once complete
+    in_.reserve(std::max(READ_SIZE, inChunkSize_ + rtmp::MAX_CHUNK_HEADER_SIZE + 2));
+    auto self(shared_from_this());
+    socket_.async_read_some(boost::asio::buffer(in_.writeBuffer(), in_.writableSize()),
+    [this, self](const boost::system::error_code & ec, std::size_t n) {
+        if(ec) {
+            fail("read");
+            return;
+        }
+        in_.commit(n);
+        bytesIn_.add(n);
+        while(decodeChunk()) {
+        }
+        if(failed_) {
+            return;
+        }
+        if(windowAckSize_ > 0 && bytesIn_.value() - bytesAcked_ >= windowAckSize_) {
+            bytesAcked_ = bytesIn_.value();
+            rtmp::MessageEncoder(pending_, outChunkSize_).encodeAck(static_cast<uint32_t>(bytesAcked_));
+            flush();
+        }
+        doRead();
+    });
+}
+
+bool BenchClient::decodeChunk()
+{
+    const uint8_t *data = in_.readBuffer();
+    uint32_t size = in_.readableSize();
+    uint32_t pos = 1;
+    if(size < 1) {
+        return false;
+    }
+    uint8_t fmt = data[0] >> 6;
+    uint32_t cid = data[0] & 0x3f;
+    if(cid == 0) {
+        if(size < 2) {
+            return false;
+        }
+        cid = 64 + data[1];
+        pos = 2;
+    } else if(cid == 1) {
+        if(size < 3) {
+            return false;
+        }
+        cid = 64 + data[1] + (data[2] << 8);
+        pos = 3;
+    }
+    if(size < pos + rtmp::ChunkHeaderSize[fmt]) {
+        return false;
+    }
+    InMessage &m = inMessages_[cid];
+    // only lengths and types matter here, the latency comes from the payload
+    uint32_t field = 0, length = m.length;
+    uint8_t type = m.type;
+    if(fmt <= rtmp::CHUNK_TYPE_2) {
+        loadBE<uint32_t, 24>(data + pos, field);
+    }
+    if(fmt <= rtmp::CHUNK_TYPE_1) {
+        loadBE<uint32_t, 24>(data + pos + 3, length);
+        type = data[pos + 6];
+    }
+    pos += rtmp::ChunkHeaderSize[fmt];
+    bool extended = fmt <= rtmp::CHUNK_TYPE_2 ? field == rtmp::EXTENDED_TIMESTAMP : m.extended;
+    if(extended) {
+        pos += 4;
+    }
+    uint32_t body = std::min<uint32_t>(length - m.payload.size(), inChunkSize_);
+    if(size < pos + body) {
+        return false;
+    }
+    m.length = length;
+    m.type = type;
+    m.extended = extended;
+    m.payload.append((const char *)data + pos, body);
+    in_.erase(pos + body);
+    if(m.payload.size() >= m.length) {
+        bool ok = onMessage(m);
+        m.payload.clear();
+        if(!ok) {
+            fail("protocol");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BenchClient::onMessage(InMessage &m)
+{
+    uint32_t value = 0;
+    if(m.payload.size() >= 4) {
+        loadBE<uint32_t, 32>(m.payload.data(), value);
+    }
+    switch(m.type) {
+    case rtmp::TYPE_SET_CHUNK_SIZE:
+        inChunkSize_ = value & 0x7fffffff;
+        return inChunkSize_ > 0;
+    case rtmp::TYPE_WINDOW_ACKNOWLEDGEMENT_SIZE:
+        windowAckSize_ = value;
+        return true;
+    case rtmp::TYPE_INVOKE:
+        return onInvoke(m.payload);
+    case rtmp::TYPE_AUDIO:
+    case rtmp::TYPE_VIDEO:
+        onMedia(m);
+        return true;
+    default:
+        return true;
+    }
+}
+
+bool BenchClient::onInvoke(std::string_view data)
+{
+    rtmp::AmfDecoder decoder(data);
+    rtmp::AmfItem command, tid;
+    if(!decoder.get(command) || !decoder.get(tid) || command.type != rtmp::AMF0_STRING) {
+        return false;
+    }
+    if(command.s == std::string_view("_result")) {
+        // connect, then createStream, then play or publish
+        rtmp::MessageEncoder enc(pending_, outChunkSize_);
+        if(tid.n == rtmp::TRANSACTION_ID_CLIENT_CONNECT) {
+            enc.encodeCreateStream(rtmp::TRANSACTION_ID_CLIENT_CREATE_STREAM);
+        } else if(tid.n == rtmp::TRANSACTION_ID_CLIENT_CREATE_STREAM) {
+            rtmp::AmfItem null_obj, sid;
+            if(!decoder.get(null_obj) || !decoder.get(sid) || sid.type != rtmp::AMF0_NUMBER) {
+                return false;
+            }
+            streamId_ = static_cast<uint32_t>(sid.n);
+            if(role_ == Role::PUBLISH) {
+                enc.encodePublish("live", name_.c_str(), streamId_, rtmp::TRANSACTION_ID_CLIENT_PUBLISH);
+            } else {
+                enc.encodePlay(name_.c_str(), streamId_, rtmp::TRANSACTION_ID_CLIENT_PLAY);
+            }
+        }
+        flush();
+    } else if(command.s == std::string_view("_error")) {
+        return false;
+    } else if(command.s == std::string_view("onStatus")) {
+        rtmp::AmfItem null_obj;
+        rtmp::AmfValue info[2] = { std::string_view("level"), std::string_view("code") };
+        if(!decoder.get(null_obj) || !decoder.get(info, 2)) {
+            return false;
+        }
+        if(info[0].val.type == rtmp::AMF0_STRING && info[0].val.s == std::string_view("error")) {
+            return false;
+        }
+        if(ready_ || info[1].val.type != rtmp::AMF0_STRING) {
+            return true;
+        }
+        if(role_ == Role::PUBLISH && info[1].val.s == std::string_view("NetStream.Publish.Start")) {
+            ready_ = true;
+            rtmp::MessageEncoder enc(pending_, outChunkSize_);
+            enc.encodeMessage(std::string_view((const char *)AUDIO_CONFIG, sizeof(AUDIO_CONFIG)),
+                              rtmp::TYPE_AUDIO, rtmp::CID_AUDIO, streamId_, 0);
+            enc.encodeMessage(std::string_view((const char *)VIDEO_CONFIG, sizeof(VIDEO_CONFIG)),
+                              rtmp::TYPE_VIDEO, rtmp::CID_VIDEO, streamId_, 0);
+            start_ = std::chrono::steady_clock::now();
+            doSend();
+        } else if(role_ == Role::PLAY && info[1].val.s == std::string_view("NetStream.Play.Start")) {
+            ready_ = true;
+        }
+    }
+    return true;
+}
+
+void BenchClient::onMedia(const InMessage &m)
+{
+    // codec headers carry no stamp
+    uint32_t offset = m.type == rtmp::TYPE_VIDEO ? VIDEO_TAG_HEADER_SIZE : AUDIO_TAG_HEADER_SIZE;
+    if(m.payload.size() < offset + STAMP_SIZE || m.payload[1] == 0) {
+        return;
+    }
+    frames_.add();
+    if(measuring.load(std::memory_order_relaxed)) {
+        uint64_t sent, now = nowNanos();
+        loadBE<uint64_t, 64>(m.payload.data() + offset, sent);
+        latencies_.push_back(now > sent ? static_cast<uint32_t>((now - sent) / 1000) : 0);
+    }
+}
+
+void BenchClient::doSend()
+{
+    if(stopped_) {
+        return;
+    }
+    uint32_t videoSize = std::max(VIDEO_TAG_HEADER_SIZE + STAMP_SIZE, pattern_.videoBitrate * 125 / pattern_.fps);
+    uint32_t audioSize = std::max(AUDIO_TAG_HEADER_SIZE + STAMP_SIZE,
+                                  (uint32_t)((uint64_t)pattern_.audioBitrate * 125 * AUDIO_FRAME_SAMPLES / AUDIO_SAMPLE_RATE));
+    auto now = std::chrono::steady_clock::now();
+    // every frame due by now, in timestamp order
+    for(;;) {
+        auto video = start_ + std::chrono::nanoseconds(videoFrames_ * 1000000000ull / pattern_.fps);
+        auto audio = pattern_.audioBitrate == 0 ? std::chrono::steady_clock::time_point::max()
+                     : start_ + std::chrono::nanoseconds(audioFrames_ * 1000000000ull * AUDIO_FRAME_SAMPLES / AUDIO_SAMPLE_RATE);
+        auto next = std::min(video, audio);
+        if(next > now) {
+            auto self(shared_from_this());
+            timer_.expires_at(next);
+            timer_.async_wait([this, self](const boost::system::error_code & ec) {
+                if(!ec) {
+                    doSend();
+                }
+            });
+            break;
+        }
+        uint32_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(next - start_).count();
+        if(video <= audio) {
+            sendMedia(rtmp::TYPE_VIDEO, timestamp, videoFrames_ % pattern_.gop == 0, videoSize);
+            videoFrames_++;
+        } else {
+            sendMedia(rtmp::TYPE_AUDIO, timestamp, false, audioSize);
+            audioFrames_++;
+        }
+    }
+    flush();
+}
+
+void BenchClient::sendMedia(uint8_t type, uint32_t timestamp, bool keyFrame, uint32_t size)
+{
+    if(media_.size() < size) {
+        media_.resize(size, '\x5a');
+    }
+    uint32_t offset;
+    if(type == rtmp::TYPE_VIDEO) {
+        // AVC NALU, composition time 0
+        media_[0] = keyFrame ? 0x17 : 0x27;
+        media_[1] = 1;
+        media_[2] = media_[3] = media_[4] = 0;
+        offset = VIDEO_TAG_HEADER_SIZE;
+    } else {
+        // AAC raw
+        media_[0] = (char)0xaf;
+        media_[1] = 1;
+        offset = AUDIO_TAG_HEADER_SIZE;
+    }
+    storeBE<uint64_t, 64>(&media_[offset], nowNanos());
+    rtmp::MessageEncoder(pending_, outChunkSize_).encodeMessage(std::string_view(media_.data(), size), type,
+            type == rtmp::TYPE_VIDEO ? rtmp::CID_VIDEO : rtmp::CID_AUDIO, streamId_, timestamp);
+}
+
+void BenchClient::flush()
+{
+    if(writing_ || stopped_ || pending_.readableSize() == 0) {
+        return;
+    }
+    out_.clear();
+    out_.swap(pending_);
+    writing_ = true;
+    auto self(shared_from_this());
+    boost::asio::async_write(socket_, boost::asio::buffer(out_.readBuffer(), out_.readableSize()),
+    [this, self](const boost::system::error_code & ec, std::size_t n) {
+        writing_ = false;
+        if(ec) {
+            fail("write");
+            return;
+        }
+        bytesOut_.add(n);
+        flush();
+    });
+}
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "Buffer.hpp"
+#include "Metrics.hpp"
+
+namespace ms777::bench {
+// Synthetic A/V pattern sent by a publisher: constant size video frames at
+// fps with a key frame every gop frames, AAC sized audio frames at 44.1 kHz.
+struct Pattern {
+    uint32_t videoBitrate; // kbps
+    uint32_t audioBitrate; // kbps, 0 = no audio
+    uint32_t fps;
+    uint32_t gop; // frames
+};
+
+// One RTMP connection of the load generator, publishing the pattern or
+// playing a stream. Every media payload carries the steady clock time it
+// was sent at, players turn it into publisher to viewer latency.
+class BenchClient : public std::enable_shared_from_this<BenchClient>
+{
+public:
+    enum class Role {
+        PUBLISH, PLAY
+    };
+
+    BenchClient(boost::asio::io_context &io, Role role, const std::string &app, const std::string &name,
+                const Pattern &pattern);
+
+    void start(const boost::asio::ip::tcp::endpoint &endpoint);
+    void stop();
+
+    // publishing or playing
+    bool ready()
+    {
+        return ready_;
+    }
+
+    bool failed()
+    {
+        return failed_;
+    }
+
+    uint64_t bytesIn()
+    {
+        return bytesIn_.value();
+    }
+
+    uint64_t bytesOut()
+    {
+        return bytesOut_.value();
+    }
+
+    uint64_t frames()
+    {
+        return frames_.value();
+    }
+
+    // latency of the media received while measuring, in us, read once the client thread is gone
+    const std::vector<uint32_t> &latencies()
+    {
+        return latencies_;
+    }
+
+    static std::atomic<bool> measuring;
+
+private:
+    struct InMessage {
+        uint8_t type{ 0 };
+        uint32_t length{ 0 };
+        bool extended{ false }; // continuation chunks repeat the extended timestamp
+        std::string payload;
+    };
+
+    void doHandshake();
+    void doRead();
+    bool decodeChunk();
+    bool onMessage(InMessage &m);
+    bool onInvoke(std::string_view data);
+    void onMedia(const InMessage &m);
+    void doSend();
+    void sendMedia(uint8_t type, uint32_t timestamp, bool keyFrame, uint32_t size);
+    void flush();
+    void fail(const char *what);
+
+private:
+    boost::asio::ip::tcp::socket socket_;
+    boost::asio::steady_timer timer_;
+    Role role_;
+    std::string app_;
+    std::string name_;
+    Pattern pattern_;
+    std::string tcUrl_;
+    std::atomic<bool> ready_{ false };
+    std::atomic<bool> failed_{ false };
+    bool stopped_{ false };
+    std::vector<uint8_t> handshake_;
+    // input
+    Buffer in_;
+    std::map<uint32_t, InMessage> inMessages_;
+    uint32_t inChunkSize_{ 128 };
+    uint32_t windowAckSize_{ 0 };
+    uint64_t bytesAcked_{ 0 };
+    // output
+    Buffer out_; // being written
+    Buffer pending_; // queued behind it
+    bool writing_{ false };
+    uint32_t outChunkSize_{ 4096 };
+    uint32_t streamId_{ 0 };
+    std::string media_; // scratch payload
+    std::chrono::steady_clock::time_point start_;
+    uint64_t videoFrames_{ 0 };
+    uint64_t audioFrames_{ 0 };
+    Counter bytesIn_;
+    Counter bytesOut_;
+    Counter frames_;
+    std::vector<uint32_t> latencies_;
+};
+}
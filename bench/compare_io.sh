@@ -0,0 +1,64 @@
+#!/bin/bash
+# epoll against io_uring under the same load, 10k subscribers by default:
+#   bench/compare_io.sh [streams] [subscribers per stream] [seconds measured] [seconds of warmup]
+# builds both servers, runs each on its own with ms777-bench as the client
+# and prints the bench report, plus syscalls per second when perf is there.
+# io_uring needs Boost >= 1.78 and liburing, without them only epoll runs.
+set -e
+cd "$(dirname "$0")/.."
+STREAMS=${1:-10}
+SUBSCRIBERS=${2:-1000}
+DURATION=${3:-20}
+WARMUP=${4:-15}
+PORT=19350
+OUT=build/compare_io
+mkdir -p $OUT
+
+# each backend is configured and built apart, the project's own config stays as it was
+xmake_for() {
+    local backend=$1
+    shift
+    XMAKE_CONFIGDIR=$PWD/$OUT/config-$backend xmake "$@"
+}
+
+backends=
+for backend in epoll io_uring; do
+    if [ $backend = io_uring ]; then uring=y; else uring=n; fi
+    xmake_for $backend f -m release --io_uring=$uring -o $OUT/build-$backend -y > /dev/null
+    if ! xmake_for $backend build ms777 ms777-bench > $OUT/build-$backend.log 2>&1; then
+        echo "== $backend does not build here, see $OUT/build-$backend.log"
+        continue
+    fi
+    xmake_for $backend install -o $OUT/$backend ms777 > /dev/null
+    # one client for both runs
+    if [ $backend = epoll ]; then
+        xmake_for $backend install -o $OUT/bench ms777-bench > /dev/null
+    fi
+    backends="$backends $backend"
+done
+ulimit -n 65536
+
+for backend in $backends; do
+    echo "== $backend"
+    $OUT/$backend/bin/ms777 --rtmp_server_port=$PORT --http_server_port=0 --server_threads=0 --log_level=warn &
+    pid=$!
+    sleep 1
+    log=$OUT/bench-$backend.log
+    : > $log
+    perfpid=
+    if command -v perf > /dev/null; then
+        # the measured window starts once every client is up and warmed
+        (for i in $(seq 600); do grep -q "clients up" $log && break; sleep 0.2; done
+         grep -q "clients up" $log || exit 0
+         sleep $WARMUP
+         perf stat -e raw_syscalls:sys_enter -p $pid -- sleep $DURATION 2>&1 |
+         awk '/raw_syscalls/ { printf "syscalls    %10.0f /s\n", $1 / '$DURATION' }') &
+        perfpid=$!
+    fi
+    $OUT/bench/bin/ms777-bench --bench_target=127.0.0.1:$PORT --bench_server_pid=$pid --bench_streams=$STREAMS \
+        --bench_subscribers=$SUBSCRIBERS --bench_threads=4 --bench_warmup=$WARMUP --bench_duration=$DURATION \
+        2> >(tee $log >&2) || true
+    [ -n "$perfpid" ] && wait $perfpid
+    kill $pid
+    wait $pid || true
+done
@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <future>
+#include <thread>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <spdlog/spdlog.h>
+#include "BenchClient.hpp"
+#include "Server.hpp"
+#include "Conf.hpp"
+
+DEFINE_string(bench_target, "", "host:port of a running server, empty = start one in-process on --rtmp_server_port");
+DEFINE_uint32(bench_server_pid, 0, "pid of the server behind --bench_target, for its CPU and RSS (0 = not measured)");
+DEFINE_uint32(bench_streams, 1, "number of publishers, one stream each");
+DEFINE_uint32(bench_subscribers, 10, "number of subscribers per stream");
+DEFINE_uint32(bench_video_bitrate, 2500, "video kbps of each publisher");
+DEFINE_uint32(bench_audio_bitrate, 128, "audio kbps of each publisher (0 = no audio)");
+DEFINE_uint32(bench_fps, 25, "video frames per second");
+DEFINE_uint32(bench_gop, 50, "video frames per key frame");
+DEFINE_uint32(bench_warmup, 3, "seconds of streaming before measuring");
+DEFINE_uint32(bench_duration, 10, "seconds measured");
+DEFINE_uint32(bench_threads, 1, "client threads, each with its own event loop");
+DEFINE_string(bench_app, "bench", "app of the benchmark streams");
+
+using namespace ms777;
+using ms777::bench::BenchClient;
+
+namespace {
+struct Sample {
+    std::chrono::steady_clock::time_point time;
+    uint64_t bytesIn{ 0 };
+    uint64_t bytesOut{ 0 };
+    uint64_t frames{ 0 };
+    double serverCpu{ -1 }; // seconds, -1 = unknown
+    int64_t serverSwitches{ -1 }; // context switches, -1 = unknown
+};
+
+double cpuSeconds(clockid_t clock)
+{
+    timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// utime + stime of a process
+double processCpuSeconds(uint32_t pid)
+{
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string line;
+    if(!std::getline(stat, line) || line.rfind(')') == std::string::npos) {
+        return -1;
+    }
+    // fields after the command name, utime and stime are the 12th and 13th
+    std::istringstream fields(line.substr(line.rfind(')') + 2));
+    std::string field;
+    unsigned long long utime = 0, stime = 0;
+    for(int i = 0; i < 13 && fields >> field; i++) {
+        if(i == 11) {
+            utime = std::stoull(field);
+        } else if(i == 12) {
+            stime = std::stoull(field);
+        }
+    }
+    return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+// resident set size in KiB, 0 if unknown
+uint64_t rssKiB(uint32_t pid)
+{
+    std::ifstream status(pid == 0 ? std::string("/proc/self/status") : "/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while(std::getline(status, line)) {
+        if(line.compare(0, 6, "VmRSS:") == 0) {
+            return std::stoull(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+// voluntary and involuntary context switches in a /proc/.../status
+int64_t contextSwitches(const std::string &status)
+{
+    std::ifstream in(status);
+    std::string line;
+    int64_t n = 0;
+    while(std::getline(in, line)) {
+        if(line.compare(0, 24, "voluntary_ctxt_switches:") == 0) {
+            n += std::stoll(line.substr(24));
+        } else if(line.compare(0, 27, "nonvoluntary_ctxt_switches:") == 0) {
+            n += std::stoll(line.substr(27));
+        }
+    }
+    return n;
+}
+
+// context switches of all threads of a process, a thread blocking for
+// readiness or completions counts one per wakeup
+int64_t processContextSwitches(uint32_t pid)
+{
+    std::string task = pid == 0 ? std::string("/proc/self/task") : "/proc/" + std::to_string(pid) + "/task";
+    DIR *dir = opendir(task.c_str());
+    if(!dir) {
+        return -1;
+    }
+    int64_t n = 0;
+    while(dirent *e = readdir(dir)) {
+        if(e->d_name[0] != '.') {
+            n += contextSwitches(task + "/" + e->d_name + "/status");
+        }
+    }
+    closedir(dir);
+    return n;
+}
+
+// CPU time of every client thread, read on the threads themselves
+double clientCpuSeconds(std::vector<std::unique_ptr<boost::asio::io_context>> &ios)
+{
+    double total = 0;
+    for(auto &io : ios) {
+        std::promise<double> cpu;
+        boost::asio::post(*io, [&cpu]() {
+            cpu.set_value(cpuSeconds(CLOCK_THREAD_CPUTIME_ID));
+        });
+        total += cpu.get_future().get();
+    }
+    return total;
+}
+
+int64_t clientContextSwitches(std::vector<std::unique_ptr<boost::asio::io_context>> &ios)
+{
+    int64_t total = 0;
+    for(auto &io : ios) {
+        std::promise<int64_t> n;
+        boost::asio::post(*io, [&n]() {
+            n.set_value(contextSwitches("/proc/thread-self/status"));
+        });
+        total += n.get_future().get();
+    }
+    return total;
+}
+
+bool waitReady(std::vector<std::shared_ptr<BenchClient>> &clients, std::chrono::seconds timeout)
+{
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    while(std::chrono::steady_clock::now() < deadline) {
+        bool ready = std::all_of(clients.begin(), clients.end(), [](auto & c) {
+            return c->ready() || c->failed();
+        });
+        if(ready) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+uint32_t percentile(std::vector<uint32_t> &v, double p)
+{
+    if(v.empty()) {
+        return 0;
+    }
+    std::size_t n = std::min(v.size() - 1, (std::size_t)(p * v.size()));
+    std::nth_element(v.begin(), v.begin() + n, v.end());
+    return v[n];
+}
+}
+
+int main(int argc, char **argv)
+{
+    // the in-process server stays quiet and off HTTP unless asked otherwise
+    FLAGS_log_level = "warn";
+    FLAGS_http_server_port = 0;
+    gflags::SetUsageMessage("Usage: ms777-bench [--bench_target=host:port] [--bench_streams=N] [--bench_subscribers=M] ...\n");
+    gflags::SetVersionString("1.0");
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    spdlog::set_level(spdlog::level::from_str(FLAGS_log_level));
+    FLAGS_bench_fps = std::max(FLAGS_bench_fps, 1u);
+    FLAGS_bench_gop = std::max(FLAGS_bench_gop, 1u);
+    FLAGS_bench_threads = std::max(FLAGS_bench_threads, 1u);
+
+    std::unique_ptr<Server> server;
+    std::thread serverThread;
+    std::string host = "127.0.0.1";
+    std::string port = std::to_string(FLAGS_rtmp_server_port);
+    if(FLAGS_bench_target.empty()) {
+        server = std::make_unique<Server>();
+        serverThread = std::thread([&server]() {
+            server->run();
+        });
+        // acceptors are opened by the workers
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    } else {
+        std::size_t colon = FLAGS_bench_target.rfind(':');
+        host = FLAGS_bench_target.substr(0, colon);
+        port = colon == std::string::npos ? "1935" : FLAGS_bench_target.substr(colon + 1);
+    }
+    boost::asio::io_context resolveIo;
+    boost::asio::ip::tcp::resolver resolver(resolveIo);
+    auto endpoint = resolver.resolve(host, port)->endpoint();
+    uint32_t pid = FLAGS_bench_target.empty() ? 0 : FLAGS_bench_server_pid;
+    bool measureServer = FLAGS_bench_target.empty() || pid != 0;
+    uint64_t rssBefore = measureServer ? rssKiB(pid) : 0;
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> ios;
+    std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> guards;
+    std::vector<std::thread> threads;
+    for(uint32_t i = 0; i < FLAGS_bench_threads; i++) {
+        ios.emplace_back(std::make_unique<boost::asio::io_context>(1));
+        guards.emplace_back(ios.back()->get_executor());
+    }
+    for(auto &io : ios) {
+        threads.emplace_back([&io]() {
+            io->run();
+        });
+    }
+    bench::Pattern pattern{ FLAGS_bench_video_bitrate, FLAGS_bench_audio_bitrate, FLAGS_bench_fps, FLAGS_bench_gop };
+    std::vector<std::vector<std::shared_ptr<BenchClient>>> owned(ios.size()); // clients of each thread
+    std::size_t next = 0;
+    auto create = [&](std::vector<std::shared_ptr<BenchClient>> &clients, BenchClient::Role role, uint32_t stream) {
+        std::size_t thread = next++ % ios.size();
+        auto &io = *ios[thread];
+        auto c = std::make_shared<BenchClient>(io, role, FLAGS_bench_app, "s" + std::to_string(stream), pattern);
+        clients.push_back(c);
+        owned[thread].push_back(c);
+        boost::asio::post(io, [c, endpoint]() {
+            c->start(endpoint);
+        });
+    };
+    // publishers first, so the subscribers find the streams running
+    std::vector<std::shared_ptr<BenchClient>> publishers, subscribers;
+    for(uint32_t s = 0; s < FLAGS_bench_streams; s++) {
+        create(publishers, BenchClient::Role::PUBLISH, s);
+    }
+    bool ready = waitReady(publishers, std::chrono::seconds(10));
+    for(uint32_t s = 0; s < FLAGS_bench_streams && ready; s++) {
+        for(uint32_t i = 0; i < FLAGS_bench_subscribers; i++) {
+            create(subscribers, BenchClient::Role::PLAY, s);
+        }
+    }
+    ready = ready && waitReady(subscribers, std::chrono::seconds(30));
+    if(!ready) {
+        SPDLOG_ERROR("Bench, clients not ready in time");
+    }
+
+    auto sample = [&]() {
+        Sample s;
+        s.time = std::chrono::steady_clock::now();
+        for(auto &c : publishers) {
+            s.bytesOut += c->bytesOut();
+        }
+        for(auto &c : subscribers) {
+            s.bytesIn += c->bytesIn();
+            s.frames += c->frames();
+        }
+        if(FLAGS_bench_target.empty()) {
+            // the bench clients share the process, their threads are left out
+            s.serverCpu = cpuSeconds(CLOCK_PROCESS_CPUTIME_ID) - clientCpuSeconds(ios);
+            s.serverSwitches = processContextSwitches(0) - clientContextSwitches(ios);
+        } else if(pid != 0) {
+            s.serverCpu = processCpuSeconds(pid);
+            s.serverSwitches = processContextSwitches(pid);
+        }
+        return s;
+    };
+    // scripts sampling the server alongside the bench start their clock here
+    fprintf(stderr, "ms777-bench: clients up, %u s warmup then %u s measured\n", FLAGS_bench_warmup, FLAGS_bench_duration);
+    std::this_thread::sleep_for(std::chrono::seconds(FLAGS_bench_warmup));
+    uint64_t rssAfter = measureServer ? rssKiB(pid) : 0;
+    Sample begin = sample();
+    BenchClient::measuring = true;
+    std::this_thread::sleep_for(std::chrono::seconds(FLAGS_bench_duration));
+    BenchClient::measuring = false;
+    Sample end = sample();
+
+    // clients are stopped on their own threads, the loops end with them
+    for(std::size_t i = 0; i < ios.size(); i++) {
+        boost::asio::post(*ios[i], [&owned, i]() {
+            for(auto &c : owned[i]) {
+                c->stop();
+            }
+        });
+    }
+    guards.clear();
+    for(auto &t : threads) {
+        t.join();
+    }
+    if(server) {
+        server->stop();
+        serverThread.join();
+        server.reset();
+    }
+
+    std::vector<uint32_t> latencies;
+    std::size_t failed = 0;
+    for(auto *clients : { &publishers, &subscribers }) {
+        for(auto &c : *clients) {
+            failed += c->failed() ? 1 : 0;
+        }
+    }
+    for(auto &c : subscribers) {
+        latencies.insert(latencies.end(), c->latencies().begin(), c->latencies().end());
+    }
+    double seconds = std::chrono::duration<double>(end.time - begin.time).count();
+    double ingest = (end.bytesOut - begin.bytesOut) * 8 / seconds / 1e6;
+    double egress = (end.bytesIn - begin.bytesIn) * 8 / seconds / 1e6;
+    std::size_t connections = publishers.size() + subscribers.size();
+    printf("ms777-bench: %u streams x %u subscribers, %u+%u kbps, %.1f s measured%s\n",
+           FLAGS_bench_streams, FLAGS_bench_subscribers, FLAGS_bench_video_bitrate, FLAGS_bench_audio_bitrate, seconds,
+           FLAGS_bench_target.empty() ? ", in-process server" : "");
+    printf("ingest      %10.2f Mbps\n", ingest);
+    printf("egress      %10.2f Mbps, %.0f frames/s\n", egress, (end.frames - begin.frames) / seconds);
+    if(begin.serverCpu >= 0 && end.serverCpu >= 0) {
+        double cores = (end.serverCpu - begin.serverCpu) / seconds;
+        printf("server CPU  %10.3f cores, %.3f cores per Gbps egress\n", cores, egress > 0 ? cores / (egress / 1000) : 0.0);
+    } else {
+        printf("server CPU         n/a (--bench_server_pid)\n");
+    }
+    if(begin.serverSwitches >= 0 && end.serverSwitches >= 0) {
+        double switches = (end.serverSwitches - begin.serverSwitches) / seconds;
+        printf("server wake %10.0f context switches/s, %.0f per Gbps egress\n", switches,
+               egress > 0 ? switches / (egress / 1000) : 0.0);
+    }
+    printf("latency     p50 %.3f ms, p99 %.3f ms, max %.3f ms (%zu frames)\n", percentile(latencies, 0.5) / 1000.0,
+           percentile(latencies, 0.99) / 1000.0, percentile(latencies, 1) / 1000.0, latencies.size());
+    if(measureServer && rssAfter > 0) {
+        printf("memory      %10.1f KiB RSS per connection%s (%zu connections)\n",
+               rssAfter > rssBefore ? (double)(rssAfter - rssBefore) / std::max<std::size_t>(connections, 1) : 0.0,
+               FLAGS_bench_target.empty() ? " with the clients" : "", connections);
+    } else {
+        printf("memory             n/a (--bench_server_pid)\n");
+    }
+    printf("failed      %10zu of %zu connections\n", failed, connections);
+    google::ShutDownCommandLineFlags();
+    spdlog::shutdown();
+    return failed == 0 && ready ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+#include <benchmark/benchmark.h>
+#include <cstring>
+#include <vector>
+#include "ChunkDemuxer.hpp"
+#include "RingBuffer.hpp"
+#include "Rtmp.hpp"
+
+// Microbenchmarks of the RTMP protocol hot paths, fed from memory:
+// xmake build ms777-microbench && xmake run ms777-microbench
+using namespace ms777;
+
+namespace {
+constexpr uint32_t READ_SIZE = 8192; // --rtmp_read_buffer_size default
+constexpr uint32_t VIDEO_FRAME_SIZE = 12500; // 2.5 Mbps at 25 fps
+constexpr uint32_t AUDIO_FRAME_SIZE = 372; // 128 kbps AAC
+constexpr uint32_t GOP_MESSAGES = 50;
+
+// connect as sent by OBS
+void connectPayload(Buffer &b)
+{
+    rtmp::AmfEncoder enc(b);
+    enc.putString("connect");
+    enc.putNumber(rtmp::TRANSACTION_ID_CLIENT_CONNECT);
+    enc.putObjectBegin();
+    enc.putObjectValue("app", "live");
+    enc.putObjectValue("type", "nonprivate");
+    enc.putObjectValue("flashVer", "FMLE/3.0 (compatible; FMSc/1.0)");
+    enc.putObjectValue("swfUrl", "rtmp://127.0.0.1:1935/live");
+    enc.putObjectValue("tcUrl", "rtmp://127.0.0.1:1935/live");
+    enc.putObjectEnd();
+}
+
+void publishPayload(Buffer &b)
+{
+    rtmp::AmfEncoder enc(b);
+    enc.putString("publish");
+    enc.putNumber(rtmp::TRANSACTION_ID_CLIENT_PUBLISH);
+    enc.putNull();
+    enc.putString("stream-1080p");
+    enc.putString("live");
+}
+
+// a GOP of interleaved video and audio messages, chunked at chunkSize
+void mediaChunks(Buffer &out, uint32_t chunkSize)
+{
+    rtmp::MessageEncoder enc(out, chunkSize);
+    std::string video(VIDEO_FRAME_SIZE, 'v'), audio(AUDIO_FRAME_SIZE, 'a');
+    for(uint32_t i = 0; i < GOP_MESSAGES; i++) {
+        enc.encodeMessage(video, rtmp::TYPE_VIDEO, rtmp::CID_VIDEO, rtmp::MSID_DEFAULT, i * 40);
+        enc.encodeMessage(audio, rtmp::TYPE_AUDIO, rtmp::CID_AUDIO, rtmp::MSID_DEFAULT, i * 40);
+        enc.encodeMessage(audio, rtmp::TYPE_AUDIO, rtmp::CID_AUDIO, rtmp::MSID_DEFAULT, i * 40 + 23);
+    }
+}
+}
+
+// chunk header and body decoding as done by the session, READ_SIZE bytes per read
+static void BM_ChunkDemux(benchmark::State &state)
+{
+    uint32_t chunkSize = state.range(0);
+    Buffer input(1024 * 1024);
+    mediaChunks(input, chunkSize);
+    RingBuffer in(READ_SIZE);
+    uint64_t messages = 0;
+    for(auto _ : state) {
+        ChunkDemuxer demuxer;
+        demuxer.setChunkSize(chunkSize);
+        uint32_t offset = 0;
+        while(offset < input.readableSize()) {
+            uint32_t n = std::min(in.writableSize(), input.readableSize() - offset);
+            memcpy(in.writeBuffer(), input.readBuffer() + offset, n);
+            in.commit(n);
+            offset += n;
+            while(in.readableSize() > 0) {
+                uint32_t consumed = 0;
+                auto result = demuxer.decode(in.readBuffer(), in.readableSize(), consumed);
+                in.erase(consumed);
+                if(result == ChunkDemuxer::Result::MESSAGE) {
+                    benchmark::DoNotOptimize(demuxer.message()->payload->readBuffer());
+                    messages++;
+                } else if(result != ChunkDemuxer::Result::CHUNK) {
+                    break;
+                }
+            }
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * input.readableSize());
+    state.counters["messages"] = benchmark::Counter(messages, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_ChunkDemux)->Arg(128)->Arg(4096);
+
+// connect command object looked up by key, as done by the session
+static void BM_AmfDecodeConnect(benchmark::State &state)
+{
+    Buffer payload(512);
+    connectPayload(payload);
+    for(auto _ : state) {
+        std::string_view data = payload.stringView();
+        rtmp::AmfDecoder decoder(data);
+        rtmp::AmfItem command, tid;
+        decoder.get(command);
+        decoder.get(tid);
+        rtmp::AmfValue args[3] = { std::string_view("app"), std::string_view("tcUrl"), std::string_view("objectEncoding") };
+        benchmark::DoNotOptimize(decoder.get(args, 3));
+        benchmark::DoNotOptimize(args[0].val.s.data());
+    }
+    state.SetBytesProcessed(state.iterations() * payload.readableSize());
+}
+BENCHMARK(BM_AmfDecodeConnect);
+
+// connect command object decoded whole
+static void BM_AmfDecodeObject(benchmark::State &state)
+{
+    Buffer payload(512);
+    connectPayload(payload);
+    std::vector<rtmp::AmfValue> items;
+    for(auto _ : state) {
+        std::string_view data = payload.stringView();
+        rtmp::AmfDecoder decoder(data);
+        rtmp::AmfItem command, tid;
+        decoder.get(command);
+        decoder.get(tid);
+        items.clear();
+        benchmark::DoNotOptimize(decoder.get(items));
+    }
+    state.SetBytesProcessed(state.iterations() * payload.readableSize());
+}
+BENCHMARK(BM_AmfDecodeObject);
+
+static void BM_AmfDecodePublish(benchmark::State &state)
+{
+    Buffer payload(128);
+    publishPayload(payload);
+    for(auto _ : state) {
+        std::string_view data = payload.stringView();
+        rtmp::AmfDecoder decoder(data);
+        rtmp::AmfItem command, tid, null, name, type;
+        decoder.get(command);
+        decoder.get(tid);
+        decoder.get(null);
+        decoder.get(name);
+        benchmark::DoNotOptimize(decoder.get(type));
+    }
+    state.SetBytesProcessed(state.iterations() * payload.readableSize());
+}
+BENCHMARK(BM_AmfDecodePublish);
+
+static void BM_AmfEncodeConnect(benchmark::State &state)
+{
+    Buffer payload(512);
+    for(auto _ : state) {
+        payload.clear();
+        connectPayload(payload);
+        benchmark::DoNotOptimize(payload.readBuffer());
+    }
+}
+BENCHMARK(BM_AmfEncodeConnect);
+
+// a media message chunked at chunk size, arguments are chunk size and payload size
+static void BM_EncodeMessage(benchmark::State &state)
+{
+    uint32_t chunkSize = state.range(0);
+    std::string payload(state.range(1), 'x');
+    Buffer out(payload.size() * 2);
+    for(auto _ : state) {
+        out.clear();
+        rtmp::MessageEncoder enc(out, chunkSize);
+        enc.encodeMessage(payload, rtmp::TYPE_VIDEO, rtmp::CID_VIDEO, rtmp::MSID_DEFAULT, 40);
+        benchmark::DoNotOptimize(out.readBuffer());
+    }
+    state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_EncodeMessage)->Args({ 128, AUDIO_FRAME_SIZE })->Args({ 128, VIDEO_FRAME_SIZE })
+->Args({ 4096, AUDIO_FRAME_SIZE })->Args({ 4096, VIDEO_FRAME_SIZE });
+
+BENCHMARK_MAIN();
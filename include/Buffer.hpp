@@ -14,9 +14,9 @@ public:
     void clear();
     void swap(Buffer &other);
 
-    const uint8_t *readBuffer();
-    uint32_t readableSize();
-    std::string_view stringView();
+    const uint8_t *readBuffer() const;
+    uint32_t readableSize() const;
+    std::string_view stringView() const;
     void erase(uint32_t n);
 
     uint8_t *writeBuffer();
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+
+namespace ms777 {
+// Power-of-two size classes with a free list per thread, so buffers of
+// sessions and messages are recycled instead of going back to the heap.
+// Storage may be released on another thread than the one it came from,
+// it is then cached by the releasing thread.
+class BufferPool
+{
+public:
+    static constexpr uint32_t MIN_CLASS_SIZE = 64;
+    static constexpr uint32_t MAX_CLASS_SIZE = 4 * 1024 * 1024;
+
+    // capacity is rounded up to the size class and returned
+    static uint8_t *allocate(uint32_t &capacity);
+    static void release(uint8_t *data, uint32_t capacity);
+
+    struct Stats {
+        uint64_t hits{ 0 };
+        uint64_t misses{ 0 };
+        std::size_t cachedBytes{ 0 };
+    };
+    // of the calling thread
+    static const Stats &stats();
+};
+}
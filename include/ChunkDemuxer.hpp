@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "Frame.hpp"
+
+namespace ms777 {
+constexpr std::size_t RTMP_MAX_CHANNELS = 8;
+constexpr uint32_t RTMP_DEFAULT_CHUNK_SIZE = 128;
+
+struct RtmpMessageHeader {
+    uint8_t type{ 0 };
+    uint32_t cid{ 0 };
+    uint32_t timestamp;
+    uint32_t clock;
+    uint32_t sid;
+    uint32_t length{ 0 };
+};
+
+struct RtmpMessage {
+    RtmpMessageHeader h;
+    std::shared_ptr<Frame> payload; // reassembled in place, read-only once complete
+};
+
+// Reassembles RTMP messages from incoming chunks. It only sees bytes, not the
+// socket, so the session feeds it from its read buffer and the benchmarks
+// from memory.
+class ChunkDemuxer
+{
+public:
+    enum class Result {
+        NEED_MORE, // nothing consumed, more input needed
+        CHUNK, // a chunk header or part of a chunk body consumed
+        MESSAGE, // a message completed, see message()
+        ERROR // see error()
+    };
+
+    // consumes one chunk header or as much of the current chunk body as given
+    Result decode(const uint8_t *data, uint32_t size, uint32_t &consumed);
+
+    // body bytes of the current chunk still to come, 0 while expecting a header
+    uint32_t pendingPayload();
+    // the current chunk body is then read straight into the message payload
+    uint8_t *payloadBuffer();
+    Result commitPayload(uint32_t size);
+
+    // the completed message stays valid until the next call
+    RtmpMessage *message()
+    {
+        return message_;
+    }
+
+    const std::string &error()
+    {
+        return error_;
+    }
+
+    uint32_t chunkSize()
+    {
+        return chunkSize_;
+    }
+
+    void setChunkSize(uint32_t size)
+    {
+        chunkSize_ = size;
+    }
+
+private:
+    Result decodeHeader(const uint8_t *data, uint32_t size, uint32_t &consumed);
+    Result onPayload(RtmpMessage *m);
+    void release();
+    RtmpMessage *getMessage(uint32_t cid);
+
+private:
+    RtmpMessage messages_[RTMP_MAX_CHANNELS];
+    RtmpMessage *current_{ nullptr }; // of the chunk being read
+    RtmpMessage *message_{ nullptr }; // completed, released on the next call
+    uint32_t chunkSize_{ RTMP_DEFAULT_CHUNK_SIZE };
+    bool readingHeader_{ true };
+    std::string error_;
+};
+}
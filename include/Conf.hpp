@@ -3,9 +3,55 @@
 #include <gflags/gflags.h>
 
 DECLARE_string(log_level);
+DECLARE_uint32(server_threads);
+DECLARE_uint32(buffer_pool_max_size);
 
 DECLARE_string(rtmp_server_ip);
 DECLARE_int32(rtmp_server_port);
 DECLARE_uint32(rtmp_read_buffer_size);
+DECLARE_uint32(rtmp_direct_read_size);
 DECLARE_uint32(rtmp_chunk_size);
+DECLARE_uint32(rtmp_write_max_iovecs);
+DECLARE_uint32(rtmp_write_max_bytes);
+DECLARE_uint32(rtmp_sub_queue_max_size);
+DECLARE_uint32(rtmp_sub_queue_max_duration);
+DECLARE_uint32(rtmp_handoff_max_packets);
+DECLARE_uint32(rtmp_sub_evict_timeout);
+DECLARE_uint32(rtmp_handshake_timeout);
+DECLARE_uint32(rtmp_idle_timeout);
+DECLARE_uint32(rtmp_write_timeout);
 DECLARE_bool(rtmp_gop_cache);
+DECLARE_uint32(rtmp_gop_cache_max_size);
+DECLARE_uint32(stream_idle_timeout);
+
+DECLARE_string(http_server_ip);
+DECLARE_int32(http_server_port);
+
+DECLARE_string(record_path);
+DECLARE_string(record_streams);
+DECLARE_uint32(record_segment_size);
+DECLARE_uint32(record_segment_duration);
+DECLARE_uint32(record_batch_size);
+DECLARE_uint32(record_flush_interval);
+DECLARE_uint32(record_queue_max_size);
+DECLARE_uint32(record_threads);
+
+DECLARE_string(vod_path);
+DECLARE_string(vod_app);
+DECLARE_uint32(vod_buffer_time);
+DECLARE_uint32(vod_cache_size);
+
+DECLARE_string(hls_streams);
+DECLARE_uint32(hls_fragment);
+DECLARE_uint32(hls_playlist_length);
+
+DECLARE_string(edge_origin);
+DECLARE_uint32(edge_retry_interval);
+
+DECLARE_string(forward_targets);
+DECLARE_uint32(forward_retry_min);
+DECLARE_uint32(forward_retry_max);
+
+DECLARE_string(metrics_path);
+DECLARE_bool(metrics_local_only);
+DECLARE_bool(metrics_sessions);
@@ -0,0 +1,35 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ms777 {
+// Background threads for blocking file I/O, so a slow disk never stalls
+// the event loops. Tasks posted with the same key run in order on one thread.
+class DiskWriter
+{
+public:
+    DiskWriter(std::size_t threads);
+    ~DiskWriter(); // runs the remaining tasks, then joins
+
+    void post(std::size_t key, std::function<void()> task);
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::deque<std::function<void()>> tasks;
+        bool stopping{ false };
+        std::thread thread;
+    };
+
+    void run(Worker &w);
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers_;
+};
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <cstdint>
+#include "StreamPacket.hpp"
+
+namespace ms777::flv {
+constexpr uint32_t TAG_HEADER_SIZE = 11;
+constexpr uint32_t PREVIOUS_TAG_SIZE = 4;
+
+// FLV header with audio and video flags, followed by PreviousTagSize0
+constexpr uint8_t HEADER[] = { 'F', 'L', 'V', 1, 0x05, 0, 0, 0, 9, 0, 0, 0, 0 };
+
+// tag header written to raw memory, returns the number of bytes written
+uint32_t encodeTagHeader(uint8_t *output, uint8_t type, uint32_t size, uint32_t timestamp);
+
+// tag body of a packet, script data loses the RTMP @setDataFrame wrapper
+FrameSlice tagBody(const StreamPacket &p);
+}
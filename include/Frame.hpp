@@ -0,0 +1,61 @@
+#pragma once
+#include <memory>
+#include <string_view>
+#include "Buffer.hpp"
+
+namespace ms777 {
+// Refcounted bytes, filled once by the owner and then shared read-only
+// between streams, caches and send queues.
+class Frame
+{
+public:
+    Frame(uint32_t capacity);
+    // bytes owned elsewhere, like a file mapping, kept alive by owner
+    Frame(const uint8_t *data, uint32_t size, std::shared_ptr<const void> owner);
+
+    static std::shared_ptr<Frame> create(uint32_t capacity);
+    static std::shared_ptr<Frame> wrap(const uint8_t *data, uint32_t size, std::shared_ptr<const void> owner);
+
+    // writable storage, only valid while the frame is not shared yet
+    Buffer &buffer();
+
+    const uint8_t *readBuffer() const;
+    uint32_t readableSize() const;
+    std::string_view stringView() const;
+
+private:
+    Buffer data_;
+    const uint8_t *external_{ nullptr };
+    uint32_t externalSize_{ 0 };
+    std::shared_ptr<const void> owner_;
+};
+
+using FramePtr = std::shared_ptr<const Frame>;
+
+// A zero-copy view into a frame, which keeps the frame alive.
+class FrameSlice
+{
+public:
+    FrameSlice();
+    FrameSlice(FramePtr frame);
+    FrameSlice(FramePtr frame, uint32_t offset, uint32_t length);
+
+    FrameSlice slice(uint32_t offset, uint32_t length) const;
+    FrameSlice slice(std::string_view view) const;
+
+    const FramePtr &frame() const
+    {
+        return frame_;
+    }
+
+    const uint8_t *data() const;
+    uint32_t size() const;
+    bool empty() const;
+    std::string_view stringView() const;
+
+private:
+    FramePtr frame_;
+    uint32_t offset_;
+    uint32_t length_;
+};
+}
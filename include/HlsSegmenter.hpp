@@ -0,0 +1,73 @@
+#pragma once
+#include <deque>
+#include <mutex>
+#include <string>
+#include "Buffer.hpp"
+#include "Frame.hpp"
+#include "StreamSink.hpp"
+#include "Ts.hpp"
+
+namespace ms777 {
+// Remuxes the H.264/AAC of a stream into MPEG-TS segments cut at key frames,
+// subscribed like a viewer. Finished segments and the playlist are kept in
+// memory as shared frames, HTTP sessions on any worker only read them.
+class HlsSegmenter : public StreamSink
+{
+public:
+    HlsSegmenter(const std::string &app, const std::string &name);
+    // for a republish, carries on the numbering and the cached segments of the stopped previous one
+    HlsSegmenter(const std::string &app, const std::string &name, HlsSegmenter &previous);
+    ~HlsSegmenter();
+
+    void sendPacket(const std::shared_ptr<StreamPacket> &p) override;
+    void stop() override;
+
+    // the current playlist, null until the first segment is complete
+    FramePtr playlist();
+    // a segment still in the cache, null otherwise
+    FramePtr segment(uint64_t seq);
+
+private:
+    struct Segment {
+        uint64_t seq;
+        uint32_t duration; // ms
+        FramePtr data;
+        bool discontinuity; // first one after a republish
+    };
+
+    void onVideoHeader(const StreamPacket &p);
+    void onAudioHeader(const StreamPacket &p);
+    void onVideo(const StreamPacket &p);
+    void onAudio(const StreamPacket &p);
+    bool splitPoint(const StreamPacket &p);
+    void openSegment(uint32_t timestamp);
+    void closeSegment(uint32_t timestamp);
+    void updatePlaylist(bool end);
+
+private:
+    std::string app_;
+    std::string name_;
+    ts::Muxer muxer_;
+    // codec configuration
+    Buffer parameterSets_; // SPS and PPS in Annex B
+    uint8_t lengthSize_{ 0 }; // of the NAL units, 0 without a usable AVC header
+    uint8_t aacObjectType_{ 0 };
+    uint8_t aacFrequency_{ 0 };
+    uint8_t aacChannels_{ 0 };
+    bool hasAudio_{ false };
+    // segment being written, only touched by the publisher's worker
+    Buffer es_; // one access unit in Annex B or ADTS
+    Buffer current_;
+    bool segmentOpen_{ false };
+    uint32_t segmentStart_{ 0 };
+    uint32_t lastTimestamp_{ 0 };
+    uint64_t nextSeq_{ 0 };
+    bool discontinuity_{ false }; // the next segment follows a republish
+    bool stopped_{ false };
+    // published segments, read by the HTTP sessions
+    std::mutex mutex_;
+    std::deque<Segment> segments_;
+    uint64_t discontinuities_{ 0 }; // in segments gone from the cache
+    FramePtr playlist_;
+};
+}
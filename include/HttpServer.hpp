@@ -0,0 +1,40 @@
+#pragma once
+#include <functional>
+#include <string>
+#include "HttpSession.hpp"
+#include "Stream.hpp"
+#include "HlsSegmenter.hpp"
+
+namespace ms777 {
+class Server;
+
+class HttpServer
+{
+public:
+    HttpServer(Server &server, std::size_t index);
+    ~HttpServer();
+
+    void start();
+    void stop();
+    void stop(std::shared_ptr<HttpSession> c);
+    std::shared_ptr<Stream> subscribe(std::shared_ptr<HttpSession> c, const std::string &app, const std::string &name);
+    std::shared_ptr<HlsSegmenter> hls(const std::string &app, const std::string &name);
+    // renders the metrics of all workers, done is called on any of them
+    void metrics(std::function<void(std::string)> done);
+
+    std::size_t index()
+    {
+        return index_;
+    }
+
+private:
+    void doAccept();
+    void startSession(boost::asio::ip::tcp::socket socket);
+
+private:
+    Server &server_;
+    std::size_t index_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    SpIntrusiveList<HttpSession> sessions_;
+};
+}
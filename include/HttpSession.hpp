@@ -0,0 +1,65 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <string>
+#include "Buffer.hpp"
+#include "StreamSink.hpp"
+#include "SendQueue.hpp"
+#include "Intrusive.hpp"
+
+namespace ms777 {
+class HttpServer;
+class Stream;
+
+// Serves GET /app/name.flv as HTTP-FLV: the FLV header, then one FLV tag per
+// stream packet in chunked transfer encoding, straight from the shared frames.
+// GET /app/name.m3u8 and /app/name-N.ts are answered from the HLS segment
+// cache, on a keep-alive connection, GET --metrics_path with the Prometheus
+// metrics.
+class HttpSession
+    : public std::enable_shared_from_this<HttpSession>
+    , public SpIntrusiveList<HttpSession>::Hook
+    , public StreamSink
+    , private SendFraming
+{
+public:
+    HttpSession(HttpServer &server, boost::asio::ip::tcp::socket socket);
+
+    void start();
+    void stop() override;
+
+    void sendPacket(const std::shared_ptr<StreamPacket> &p) override;
+    void collectMetrics(const std::string &labels, SessionMetrics &out) override;
+
+private:
+    void doReadRequest();
+    bool onRequest();
+    bool playFlv(const std::string &app, const std::string &name);
+    bool playHls(const std::string &app, std::string_view file);
+    bool sendMetrics();
+    bool fromLoopback();
+    void sendContent(std::string_view type, const FramePtr &body);
+    void sendResponse(uint32_t status, std::string_view reason);
+    void doReadClose();
+    void doWrite();
+    void encodeFraming(SendEntry &e) override;
+    uint32_t segments(const SendEntry &e) override;
+    boost::asio::const_buffer buffer(const SendEntry &e, uint32_t segment) override;
+    void stopSession();
+
+private:
+    HttpServer &server_;
+    boost::asio::ip::tcp::socket socket_;
+    std::string request_;
+    std::size_t requestSize_{ 0 };
+    bool keepAlive_{ false };
+    bool responding_{ false }; // read the next request once the response is written
+    uint8_t discard_[256];
+    Buffer outBuffer_;
+    SendQueue sendQueue_;
+    bool closeAfterWrite_{ false };
+    bool stopped_{ false };
+    uint64_t bytesWritten_{ 0 };
+    uint64_t packetsWritten_{ 0 };
+    std::shared_ptr<Stream> stream_;
+};
+}
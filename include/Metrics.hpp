@@ -0,0 +1,103 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace ms777 {
+class Server;
+
+// Counter written by one thread only, read by the metrics endpoint from any
+// thread: a relaxed load and store, no locked add on the hot path.
+class Counter
+{
+public:
+    void add(uint64_t n = 1)
+    {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value_{ 0 };
+};
+
+// Latency histogram with fixed buckets from 100us to 10s, one writer thread as well.
+class Histogram
+{
+public:
+    static constexpr std::size_t BUCKETS = 16;
+    static const double BOUNDS[BUCKETS];
+
+    void observe(std::chrono::steady_clock::duration d);
+
+    // cumulative count of bucket i, BUCKETS for +Inf
+    uint64_t bucket(std::size_t i) const
+    {
+        return buckets_[i].value();
+    }
+
+    uint64_t count() const
+    {
+        return buckets_[BUCKETS].value();
+    }
+
+    double sum() const
+    {
+        return sumNanos_.value() / 1e9;
+    }
+
+private:
+    Counter buckets_[BUCKETS + 1];
+    Counter sumNanos_;
+};
+
+// Counters of one worker, only updated from the worker's own thread.
+struct alignas(64) WorkerMetrics {
+    Counter rtmpConnections;
+    Counter rtmpBytesIn;
+    Counter rtmpBytesOut;
+    Counter rtmpMessagesIn;
+    Counter rtmpMessagesOut;
+    Counter rtmpWrites;
+    Counter httpConnections;
+    Counter httpBytesOut;
+    Counter droppedVideo;
+    Counter droppedAudio;
+    Counter evicted;
+    Counter publishersMoved;
+    Histogram handshake;
+    Histogram connect;
+    Histogram fanout;
+};
+
+// Per session samples gathered on each worker, merged by family.
+struct SessionMetrics {
+    enum Family {
+        BYTES_IN, BYTES_OUT, MESSAGES_IN, MESSAGES_OUT, QUEUE_BYTES, DROPPED_VIDEO, DROPPED_AUDIO, FAMILIES
+    };
+
+    bool detailed{ false }; // one sample per session, only the totals otherwise
+    uint64_t queueBytes{ 0 };
+    std::string lines[FAMILIES];
+
+    void add(Family family, const std::string &labels, uint64_t value);
+};
+
+class Metrics
+{
+public:
+    static void init(std::size_t workers);
+    // counters of the calling worker
+    static WorkerMetrics &local();
+    // Prometheus text format, the per session part is collected on each
+    // worker's own thread, done is called on the last one to finish
+    static void render(Server &server, std::function<void(std::string)> done);
+    static std::string labelValue(std::string_view value);
+};
+}
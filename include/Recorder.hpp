@@ -0,0 +1,55 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+#include "StreamSink.hpp"
+
+namespace ms777 {
+class DiskWriter;
+
+// Records a stream to FLV files, subscribed like a viewer. Packets are
+// batched on the worker thread and written by the DiskWriter, a new file
+// starts at a key frame once the current one is over the size or duration
+// limit. If the disk falls behind, frames are dropped here instead.
+class Recorder : public StreamSink
+{
+public:
+    Recorder(DiskWriter &writer, const std::string &app, const std::string &name);
+    ~Recorder();
+
+    void sendPacket(const std::shared_ptr<StreamPacket> &p) override;
+    void stop() override;
+
+    // app and name become file path parts, so they cannot leave record_path
+    static bool validName(const std::string &app, const std::string &name);
+
+private:
+    struct File;
+
+    bool splitPoint(const StreamPacket &p);
+    void openSegment(uint32_t timestamp);
+    void flush(bool close = false);
+
+private:
+    DiskWriter &writer_;
+    std::string app_;
+    std::string name_;
+    std::size_t key_;
+    std::shared_ptr<File> file_; // only touched by the disk thread
+    std::string openPath_;
+    uint32_t base_{ 0 }; // first timestamp of the segment, files start at 0
+    std::vector<std::shared_ptr<StreamPacket>> batch_;
+    std::size_t batchBytes_{ 0 };
+    uint32_t batchStart_{ 0 };
+    std::size_t leadingHeaders_{ 0 }; // cached headers starting the batch, written at 0
+    bool segmentOpen_{ false };
+    uint32_t segments_{ 0 };
+    uint64_t segmentBytes_{ 0 };
+    std::shared_ptr<StreamPacket> metaData_;
+    std::shared_ptr<StreamPacket> audioHeader_;
+    std::shared_ptr<StreamPacket> videoHeader_;
+    bool skipVideo_{ false };
+    uint64_t dropped_{ 0 };
+    bool stopped_{ false };
+};
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstdint>
+#include <string_view>
+
+namespace ms777 {
+// Input buffer mapped twice back to back, so readable and writable regions
+// are always contiguous even across the wrap and consuming never compacts.
+// Without mirrored mappings, it falls back to a linear buffer which moves
+// the unread bytes only when more than half of it has been consumed.
+// A mirrored ring costs two entries of vm.max_map_count (65530 by default),
+// so only a quarter of that many rings are mirrored, about 16k sessions,
+// later ones get the linear buffer; raise the sysctl for more.
+class RingBuffer
+{
+public:
+    RingBuffer(uint32_t capacity);
+    ~RingBuffer();
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    void clear();
+
+    const uint8_t *readBuffer() const;
+    uint32_t readableSize() const;
+    std::string_view stringView() const;
+    void erase(uint32_t n);
+
+    uint8_t *writeBuffer();
+    uint32_t writableSize() const;
+    void commit(uint32_t n);
+
+    uint32_t capacity() const;
+
+private:
+    uint8_t *start_{ nullptr };
+    uint32_t capacity_{ 0 };
+    uint32_t readPos_{ 0 };
+    uint32_t size_{ 0 };
+    bool mirrored_{ false };
+};
+}
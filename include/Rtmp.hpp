@@ -52,11 +52,15 @@ constexpr uint8_t CHUNK_TYPE_2 = 2; // 3-bytes: delta(3)
 constexpr uint8_t CHUNK_TYPE_3 = 3; // 0-byte
 
 constexpr uint32_t ChunkHeaderSize[] = { 11, 7, 3, 0 };
+constexpr uint32_t MAX_CHUNK_HEADER_SIZE = 16; // 1-byte basic header + 11 + extended timestamp(4)
+constexpr uint32_t EXTENDED_TIMESTAMP = 0xffffff;
 
 constexpr uint32_t TRANSACTION_ID_CLIENT_CONNECT = 1;
 constexpr uint32_t TRANSACTION_ID_CLIENT_CREATE_STREAM = 2;
 constexpr uint32_t TRANSACTION_ID_CLIENT_PLAY = 3;
 constexpr uint32_t TRANSACTION_ID_CLIENT_PUBLISH = 3;
+constexpr uint32_t TRANSACTION_ID_CLIENT_RELEASE_STREAM = 4;
+constexpr uint32_t TRANSACTION_ID_CLIENT_FC_PUBLISH = 5;
 
 constexpr uint8_t AMF0_UNKNOWN = 0xFF;
 constexpr uint8_t AMF0_NUMBER = 0x00;
@@ -77,6 +81,24 @@ constexpr uint8_t AMF0_RECORDSET = 0x0E;
 constexpr uint8_t AMF0_XML_DOCUMENT = 0x0F;
 constexpr uint8_t AMF0_TYPED_OBJECT = 0x10;
 
+// last message header sent on an outgoing chunk stream
+struct ChunkStreamState {
+    bool valid{ false };
+    bool hasDelta{ false }; // field holds a delta, fmt 3 may repeat it
+    uint8_t type{ 0 };
+    uint32_t sid{ 0 };
+    uint32_t length{ 0 };
+    uint32_t timestamp{ 0 };
+    uint32_t field{ 0 }; // timestamp or delta of the header, repeated by extended fmt 3 chunks
+};
+
+// chunk headers written to raw memory, return the number of bytes written
+uint32_t encodeChunkHeader0(uint8_t *output, uint8_t type, uint32_t length, uint8_t cid, uint32_t sid, uint32_t timestamp);
+// continuation chunk, field is the timestamp or delta of the message's first header
+uint32_t encodeChunkHeader3(uint8_t *output, uint8_t cid, uint32_t field);
+// first chunk of a message, the smallest of fmt 0/1/2/3 given the chunk stream state, which is updated
+uint32_t encodeChunkHeader(uint8_t *output, ChunkStreamState &state, uint8_t type, uint32_t length, uint8_t cid, uint32_t sid, uint32_t timestamp);
+
 struct AmfDate {
     double ms;
     uint32_t tz;
@@ -122,6 +144,12 @@ public:
     bool get(AmfValue *items, std::size_t count);
     bool get(std::vector<AmfValue> &items);
 
+    // what is left after the values read so far
+    std::string_view remaining() const
+    {
+        return data_;
+    }
+
 private:
     void copy(AmfValue *item, AmfValue *items, std::size_t count);
 
@@ -187,7 +215,7 @@ private:
 class MessageEncoder
 {
 public:
-    MessageEncoder(Buffer &output);
+    MessageEncoder(Buffer &output, uint32_t chunkSize);
 
     void encodeWindowAck(uint32_t size);
     void encodeAck(uint32_t size);
@@ -199,6 +227,7 @@ public:
     void encodeConnectResult(double tid);
     void encodeOnStatusPublish(uint32_t sid);
     void encodeOnStatusPlay(uint32_t sid);
+    void encodeOnStatus(uint32_t sid, std::string_view level, std::string_view code, std::string_view description);
     void encodeCreateStreamResult(double tid);
     void encodeConnect(const char *app, const char *swf_url, const char *tc_url, uint32_t tid);
     void encodeReleaseStream(const char *stream_name, uint32_t tid);
@@ -213,9 +242,10 @@ public:
 
 private:
     void encodeChunkHeader0(uint8_t type, uint32_t length, uint8_t cid, uint32_t sid, uint32_t timestamp);
-    void encodeChunkHeader3(uint8_t cid);
+    void encodeChunkHeader3(uint8_t cid, uint32_t field);
 
 private:
     Buffer &output_;
+    uint32_t chunkSize_;
 };
 }
@@ -1,9 +1,11 @@
 #pragma once
-#include <unordered_map>
+#include <functional>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include "RtmpSession.hpp"
 #include "Stream.hpp"
+#include "TimerWheel.hpp"
 
 namespace ms777 {
 class Server;
@@ -11,23 +13,64 @@ class Server;
 class RtmpServer
 {
 public:
-    RtmpServer(Server &server);
+    RtmpServer(Server &server, std::size_t index);
     ~RtmpServer();
 
     void start();
     void stop();
     void stop(std::shared_ptr<RtmpSession> c);
     bool publish(std::shared_ptr<RtmpSession> c);
+    // the worker running app/name, publishers move there before publishing
+    RtmpServer *streamServer(const std::string &app, const std::string &name);
+    // a session moving to another worker leaves this one, called on this worker
+    void release(std::shared_ptr<RtmpSession> c);
+    // takes a session moving here with its released socket, called from its old worker
+    void adopt(std::shared_ptr<RtmpSession> c, boost::asio::ip::tcp protocol,
+               boost::asio::ip::tcp::socket::native_handle_type fd);
     void subscribe(std::shared_ptr<RtmpSession> c);
+    // edge: pulls the stream from --edge_origin unless it is published or pulled already,
+    // on the stream's worker
+    void pull(std::shared_ptr<Stream> s);
+    // pulls again after --edge_retry_interval if the stream still has viewers
+    void retryPull(std::shared_ptr<Stream> s);
+    // forward: a session publishing the stream to host[:port]
+    std::shared_ptr<RtmpSession> push(std::shared_ptr<Stream> s, const std::string &target);
+    // runs the task on this worker after ms, unless the server stops first
+    void runAfter(uint32_t ms, std::function<void()> task);
+    // the session writes what it queued once the current handler is done,
+    // everything queued in between goes out in one gathered write
+    void deferWrite(std::shared_ptr<RtmpSession> c);
+    // writes of the deferred sessions, called at the end of a demux loop or posted
+    void flushWrites();
+    // see Server::vodFile
+    std::shared_ptr<VodFile> vodFile(const std::string &name);
+
+    std::size_t index()
+    {
+        return index_;
+    }
+
+    // session timeouts of this worker
+    TimerWheel &timerWheel()
+    {
+        return timerWheel_;
+    }
 
 private:
     void doAccept();
-    std::shared_ptr<Stream> getStream(std::string &app, std::string &name);
+    void startSession(boost::asio::ip::tcp::socket socket);
+    static void splitAddress(const std::string &address, std::string &host, std::string &port);
 
 private:
     Server &server_;
+    std::size_t index_;
     boost::asio::ip::tcp::acceptor acceptor_;
     SpIntrusiveList<RtmpSession> sessions_;
-    std::unordered_map<std::string, std::shared_ptr<Stream>> streams_;
+    std::unordered_set<std::shared_ptr<boost::asio::steady_timer>> timers_;
+    TimerWheel timerWheel_;
+    std::vector<std::shared_ptr<RtmpSession>> deferred_;
+    std::vector<std::shared_ptr<RtmpSession>> flushing_; // kept for its capacity
+    bool flushPosted_{ false };
+    bool stopped_{ false };
 };
 }
@@ -1,40 +1,29 @@
 #pragma once
 #include <boost/asio.hpp>
+#include <chrono>
 #include <string>
 #include "Buffer.hpp"
+#include "RingBuffer.hpp"
+#include "Frame.hpp"
+#include "StreamPacket.hpp"
+#include "StreamSink.hpp"
+#include "SendQueue.hpp"
+#include "Rtmp.hpp"
 #include "Intrusive.hpp"
+#include "ChunkDemuxer.hpp"
+#include "VodPlayer.hpp"
 
 namespace ms777 {
-constexpr std::size_t RTMP_MAX_CHANNELS = 8;
-constexpr uint32_t RTMP_DEFAULT_CHUNK_SIZE = 128;
-
 class RtmpServer;
 class Stream;
 
-struct RtmpMessageHeader {
-    uint8_t type{ 0 };
-    uint32_t cid{ 0 };
-    uint32_t timestamp;
-    uint32_t clock;
-    uint32_t sid;
-    uint32_t length{ 0 };
-};
-
-struct RtmpMessage {
-    RtmpMessageHeader h;
-    Buffer payload;
-};
-
 class RtmpSession
     : public std::enable_shared_from_this<RtmpSession>
     , public SpIntrusiveList<RtmpSession>::Hook
+    , public StreamSink
+    , private SendFraming
 {
 public:
-    RtmpSession(RtmpServer &server, boost::asio::ip::tcp::socket socket);
-
-    void start();
-    void stop();
-
     enum class Type {
         HOST, CLIENT
     };
@@ -43,12 +32,29 @@ public:
         NONE, INPUT, OUTPUT
     };
 
+    RtmpSession(RtmpServer &server, boost::asio::ip::tcp::socket socket);
+    // outbound session playing (INPUT) or publishing (OUTPUT) app/name on another server
+    RtmpSession(RtmpServer &server, boost::asio::ip::tcp::socket socket, Direction dir,
+                const std::string &app, const std::string &name);
+
+    void start();
+    void stop() override;
+    // client side: resolve and connect, then handshake and play or publish
+    void connect(const std::string &host, const std::string &port);
+
+    Type type()
+    {
+        return type_;
+    }
+
     Direction direction()
     {
         return dir_;
     }
 
     void setStream(std::shared_ptr<Stream> stream);
+    // continues on the worker it moved to, with the socket reopened there
+    void onMoved(boost::asio::ip::tcp::socket socket);
 
     std::string &app()
     {
@@ -60,11 +66,20 @@ public:
         return name_;
     }
 
-    void sendAudioHeader(Buffer *audio);
-    void sendAudio(uint32_t timestamp, std::string_view payload);
-    void sendVideoHeader(Buffer *video);
-    void sendVideo(uint32_t timestamp, std::string_view payload);
-    void sendMetaData(std::string_view metaData);
+    void sendPacket(const std::shared_ptr<StreamPacket> &p) override;
+    // writes the packets queued since deferring, see RtmpServer::deferWrite
+    void flush();
+    void collectMetrics(const std::string &labels, SessionMetrics &out) override;
+
+    uint64_t droppedVideo()
+    {
+        return sendQueue_.droppedVideo();
+    }
+
+    uint64_t droppedAudio()
+    {
+        return sendQueue_.droppedAudio();
+    }
 
 private:
     void doReadC0C1();
@@ -72,34 +87,66 @@ private:
     void doReadS0S1();
     void doReadC2S2();
     void doReadChunk();
+    void onChunks();
     bool parseC0C1GenerateS0S1S2();
     bool parseS0S1GenerateC2();
     bool onMessage(RtmpMessage *m);
     bool onInvoke(RtmpMessage *m);
+    bool onResult(rtmp::AmfDecoder &decoder, double tid);
+    bool onStatus(rtmp::AmfDecoder &decoder);
+    bool startPublish();
+    void moveWhenIdle();
+    void onBytesRead(std::size_t n);
+    void onConnected();
+    void watchTimeouts();
+    uint32_t checkTimeouts();
     bool onNotify(RtmpMessage *m);
+    bool playVod(uint32_t ms);
+    void seekVod(uint32_t ms);
+    void watchVod();
+    uint32_t onVodTick();
     void doWrite();
-    bool decodeChunkHeader();
-    bool decodeChunkPayload();
+    void encodeFraming(SendEntry &e) override;
+    uint32_t segments(const SendEntry &e) override;
+    boost::asio::const_buffer buffer(const SendEntry &e, uint32_t segment) override;
+    void doReadChunkPayload(uint32_t size);
+    bool onChunkResult(ChunkDemuxer::Result result);
     void stopSession();
-    RtmpMessage *getMessage(uint32_t cid);
 
 private:
-    RtmpServer &server_;
+    RtmpServer *server_; // changes once when a publisher moves to its stream's worker
     boost::asio::ip::tcp::socket socket_;
     Type type_;
     Direction dir_;
-    Buffer inBuffer_;
+    RingBuffer inBuffer_;
     Buffer outBuffer_;
-    Buffer outBufferFlush_;
-    uint32_t inChunkSize_{ RTMP_DEFAULT_CHUNK_SIZE };
+    SendQueue sendQueue_;
+    bool stopped_{ false };
+    bool closed_{ false };
     uint32_t outChunkSize_{ RTMP_DEFAULT_CHUNK_SIZE };
-    RtmpMessage inMessages_[RTMP_MAX_CHANNELS];
-    bool readingChunkHeader_{ true };
-    uint8_t chunkHeaderFmt_{ 0 };
-    uint32_t chunkHeaderCid_{ 0 };
-    bool writing_{ false };
+    uint32_t windowAckSize_{ 0 }; // set by the peer, 0 = no acknowledgements
+    uint64_t bytesRead_{ 0 };
+    uint64_t bytesAcked_{ 0 };
+    uint64_t bytesWritten_{ 0 };
+    uint64_t messagesRead_{ 0 };
+    uint64_t packetsWritten_{ 0 };
+    std::chrono::steady_clock::time_point startTime_; // accepted or connecting
+    // timer wheel times in ms, see checkTimeouts
+    uint64_t startTick_{ 0 };
+    uint64_t lastRead_{ 0 };
+    uint64_t writeSince_{ 0 };
+    bool writePending_{ false };
+    bool flushPending_{ false }; // deferred to the server's flush
+    bool connected_{ false }; // publishing or playing
+    RtmpServer *moveTo_{ nullptr }; // reading stopped, moving once no write is pending
+    bool moved_{ false };
+    ChunkDemuxer demuxer_;
+    rtmp::ChunkStreamState outChannels_[RTMP_MAX_CHANNELS];
     std::shared_ptr<Stream> stream_;
+    std::unique_ptr<VodPlayer> vod_; // playing a file instead of a stream
     std::string app_;
     std::string name_;
+    std::string tcUrl_; // client side
+    uint32_t streamId_{ rtmp::MSID_DEFAULT }; // of the packets sent, from createStream on the client side
 };
 }
@@ -0,0 +1,105 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <deque>
+#include <vector>
+#include "Buffer.hpp"
+#include "Frame.hpp"
+#include "StreamPacket.hpp"
+
+namespace ms777 {
+// A queued outgoing message, written as a list of segments without copying:
+// either a stream packet framed on the fly or bytes encoded by the session.
+struct SendEntry {
+    std::shared_ptr<StreamPacket> packet;
+    FrameSlice bytes;
+    uint32_t size{ 0 };
+    uint32_t segment{ 0 }; // next segment to write
+    // protocol framing around the payload, encoded when the first segment is gathered
+    uint8_t headSize{ 0 };
+    uint8_t tailSize{ 0 };
+    uint8_t head[32];
+    uint8_t tail[8];
+};
+
+// How a session splits packet entries into segments.
+class SendFraming
+{
+public:
+    virtual ~SendFraming() = default;
+
+    // called once per packet entry, in wire order, dropped entries are never framed
+    virtual void encodeFraming(SendEntry &e) = 0;
+    virtual uint32_t segments(const SendEntry &e) = 0;
+    virtual boost::asio::const_buffer buffer(const SendEntry &e, uint32_t segment) = 0;
+};
+
+// Send queue of a subscriber: vectored writes capped by count and bytes,
+// bounded by size and duration of queued media, dropping video until the
+// next key frame (then audio) when over the limit.
+class SendQueue
+{
+public:
+    SendQueue(SendFraming &framing);
+
+    enum class Admit {
+        ACCEPT, DROP, EVICT
+    };
+
+    Admit admit(const std::shared_ptr<StreamPacket> &p);
+    void push(const std::shared_ptr<StreamPacket> &p);
+    // moves the encoded bytes out of the buffer
+    void push(Buffer &bytes);
+    // shares bytes already encoded elsewhere
+    void push(const FrameSlice &bytes);
+    // drops the packets not written yet, the stream starts over as after a seek
+    void dropQueuedPackets();
+
+    // gathers the next write, false if idle or a write is pending
+    bool gather();
+    const std::vector<boost::asio::const_buffer> &buffers()
+    {
+        return buffers_;
+    }
+    // the gathered write completed
+    void consume();
+
+    bool empty()
+    {
+        return entries_.empty();
+    }
+
+    std::size_t bytes()
+    {
+        return bytes_;
+    }
+
+    uint64_t droppedVideo()
+    {
+        return droppedVideo_;
+    }
+
+    uint64_t droppedAudio()
+    {
+        return droppedAudio_;
+    }
+
+private:
+    bool overLimit(uint32_t timestamp);
+    void dropQueuedVideo();
+    uint32_t segments(const SendEntry &e);
+    boost::asio::const_buffer buffer(const SendEntry &e, uint32_t segment);
+
+private:
+    SendFraming &framing_;
+    std::deque<SendEntry> entries_;
+    std::vector<boost::asio::const_buffer> buffers_;
+    bool writing_{ false };
+    std::size_t writeEntries_{ 0 }; // entries completely covered by the pending write
+    uint32_t writeResume_{ 0 }; // segment to resume the next entry from
+    std::size_t bytes_{ 0 };
+    bool skipVideo_{ false }; // dropping video until the next key frame
+    uint64_t overLimitSince_{ 0 };
+    uint64_t droppedVideo_{ 0 };
+    uint64_t droppedAudio_{ 0 };
+};
+}
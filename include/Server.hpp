@@ -1,7 +1,23 @@
 #pragma once
 #include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Metrics.hpp"
+#include "StreamKey.hpp"
 
 namespace ms777 {
+class RtmpServer;
+class HttpServer;
+class DiskWriter;
+class Stream;
+class VodFile;
+
 class Server
 {
 public:
@@ -9,13 +25,77 @@ public:
     ~Server();
 
     void run();
+    // stops every worker, run() returns once they are done
+    void stop();
+
+    std::size_t workers();
+    boost::asio::io_context &get_io_context(std::size_t worker);
+    RtmpServer &rtmpServer(std::size_t worker);
+    HttpServer &httpServer(std::size_t worker);
+    DiskWriter &diskWriter();
+
+    // index of the worker running on the calling thread
+    static std::size_t currentWorker();
 
-    boost::asio::io_context &get_io_context();
+    std::shared_ptr<Stream> getStream(const StreamKey &key);
+    // null if the stream does not exist, never creates it
+    std::shared_ptr<Stream> findStream(const StreamKey &key);
+    std::vector<std::shared_ptr<Stream>> streams();
+
+    // a file below --vod_path, mapped and indexed on first use then cached
+    // until it changes, null if it is missing or not FLV
+    std::shared_ptr<VodFile> vodFile(const std::string &name);
+
+    // streams in the registry run by the worker
+    std::size_t workerStreams(std::size_t worker)
+    {
+        return workerStreams_[worker];
+    }
+
+    // idle streams dropped from the registry
+    uint64_t streamsReclaimed()
+    {
+        return streamsReclaimed_.value();
+    }
 
 private:
-    void stop();
+    void reapStreams();
 
 private:
-    boost::asio::io_context io_context_;
+    std::unique_ptr<DiskWriter> diskWriter_;
+    std::unique_ptr<boost::asio::signal_set> signals_;
+    std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts_;
+    std::vector<std::unique_ptr<RtmpServer>> rtmpServers_;
+    std::vector<std::unique_ptr<HttpServer>> httpServers_;
+    struct StreamEntry {
+        std::shared_ptr<Stream> stream;
+        // idle since the last sweep found it so, reset by any lookup
+        bool idle{ false };
+        std::chrono::steady_clock::time_point idleSince;
+    };
+    // registry split by key hash, lookups on different shards do not contend
+    static constexpr std::size_t STREAM_SHARDS = 16;
+    struct alignas(64) StreamShard {
+        std::mutex mutex; // guards the streams and their idle state
+        std::unordered_map<StreamKey, StreamEntry, StreamKey::Hash> streams; // keys point into the streams
+    };
+    StreamShard &streamShard(const StreamKey &key)
+    {
+        // the low bits pick the bucket inside the shard
+        return streamShards_[(key.hash >> 24) % STREAM_SHARDS];
+    }
+    StreamShard streamShards_[STREAM_SHARDS];
+    // new streams go to the worker running the fewest
+    std::unique_ptr<std::atomic<std::size_t>[]> workerStreams_;
+    struct VodEntry {
+        std::shared_ptr<VodFile> file;
+        std::filesystem::file_time_type mtime;
+        std::uintmax_t size;
+        uint64_t used; // vodUses_ at the last lookup, the least recent goes first
+    };
+    std::mutex vodMutex_; // guards the cached files
+    std::unordered_map<std::string, VodEntry> vodFiles_;
+    uint64_t vodUses_{ 0 };
+    Counter streamsReclaimed_; // written by the sweep on worker 0
 };
 }
@@ -0,0 +1,103 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace ms777 {
+// Unbounded queue handing items from one producer thread to one consumer
+// thread without locks. Items are stored in blocks of BLOCK, the producer
+// appends a block when the last one is full and the consumer frees blocks
+// it has emptied, so only a block boundary allocates. size() lets the
+// producer bound it by its own policy.
+template<class T, std::size_t BLOCK = 64>
+class SpscQueue
+{
+public:
+    SpscQueue() : head_(new Block()), tail_(head_)
+    {
+    }
+
+    ~SpscQueue()
+    {
+        while(head_) {
+            Block *next = head_->next.load(std::memory_order_relaxed);
+            delete head_;
+            head_ = next;
+        }
+    }
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // producer
+    template<class U>
+    void push(U &&item)
+    {
+        std::size_t size = tail_->size.load(std::memory_order_relaxed);
+        if(size == BLOCK) {
+            Block *block = new Block();
+            tail_->next.store(block, std::memory_order_release);
+            tail_ = block;
+            size = 0;
+        }
+        tail_->items[size] = std::forward<U>(item);
+        tail_->size.store(size + 1, std::memory_order_release);
+        count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // items pushed and not popped yet, either side
+    std::size_t size() const
+    {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    // consumer: false when empty
+    bool pop(T &item)
+    {
+        if(!ready()) {
+            return false;
+        }
+        item = std::move(head_->items[index_++]);
+        count_.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // consumer
+    bool empty()
+    {
+        return !ready();
+    }
+
+private:
+    struct Block {
+        T items[BLOCK];
+        std::atomic<std::size_t> size{ 0 }; // items published
+        std::atomic<Block *> next{ nullptr }; // set once the block is full
+    };
+
+    // whether head_ has an item at index_, moving on to the next block when done with it
+    bool ready()
+    {
+        if(index_ < head_->size.load(std::memory_order_acquire)) {
+            return true;
+        }
+        if(index_ < BLOCK) {
+            return false;
+        }
+        Block *next = head_->next.load(std::memory_order_acquire);
+        if(!next) {
+            return false;
+        }
+        delete head_;
+        head_ = next;
+        index_ = 0;
+        return index_ < head_->size.load(std::memory_order_acquire);
+    }
+
+private:
+    Block *head_; // consumer
+    std::size_t index_{ 0 }; // consumer, next item of head_
+    alignas(64) Block *tail_; // producer
+    alignas(64) std::atomic<std::size_t> count_{ 0 };
+};
+}
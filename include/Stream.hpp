@@ -1,36 +1,156 @@
 #pragma once
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <vector>
 #include "RtmpSession.hpp"
+#include "StreamPacket.hpp"
+#include "StreamSink.hpp"
+#include "Metrics.hpp"
+#include "StreamKey.hpp"
+#include "SpscQueue.hpp"
 
 namespace ms777 {
+class Server;
+class Recorder;
+class HlsSegmenter;
+
 class Stream : public std::enable_shared_from_this<Stream>
 {
 public:
-    Stream(std::string_view app, std::string_view name);
+    // worker is the one running the stream, see worker()
+    Stream(Server &server, std::string_view app, std::string_view name, std::size_t worker);
     ~Stream();
 
-    void stop();
+    // whether app/name matches one of the comma separated patterns, * and ? wildcards
+    static bool match(const std::string &patterns, const std::string &app, const std::string &name);
+
+    const std::string &app()
+    {
+        return app_;
+    }
+
+    const std::string &name()
+    {
+        return name_;
+    }
+
+    // views into app and name, valid as long as the stream
+    const StreamKey &key()
+    {
+        return key_;
+    }
+
+    // worker the publisher is moved to, its callbacks and the fanout run there
+    std::size_t worker()
+    {
+        return worker_;
+    }
+
+    void stop(std::size_t worker);
     void stop(std::shared_ptr<RtmpSession> c);
 
     bool publish(std::shared_ptr<RtmpSession> c);
-    void subscribe(std::shared_ptr<RtmpSession> c);
+    bool published();
+    // edge: a pull retry is scheduled, new viewers wait for it
+    bool pullPending()
+    {
+        return pullPending_;
+    }
+
+    void setPullPending(bool pending)
+    {
+        pullPending_ = pending;
+    }
+    void subscribe(std::shared_ptr<StreamSink> c);
+    void unsubscribe(std::shared_ptr<StreamSink> c);
+
+    // segments of the current or last publishing, null if not served as HLS
+    std::shared_ptr<HlsSegmenter> hls();
+    // subscribers other than the stream's own recorder, segmenter and forwards
+    std::size_t viewers();
+    // no publisher, subscriber or pending pull, nothing is lost by dropping it
+    bool idle();
+    // a forward is publishing upstream, feed it from now on
+    void onPushStarted(std::shared_ptr<RtmpSession> c);
+
+    struct Stats {
+        bool published;
+        uint64_t subscribers;
+        uint64_t bytesIn;
+        uint64_t messagesIn;
+        uint64_t bytesOut;
+        uint64_t messagesOut;
+    };
+    Stats stats();
+    // samples of the sessions living on the worker, called on its thread
+    void collectMetrics(std::size_t worker, SessionMetrics &out);
 
     void onAudio(RtmpMessage *m);
     void onVideo(RtmpMessage *m);
-    bool onMeta(std::string_view metaData);
+    bool onMeta(const FrameSlice &metaData);
     bool onText(uint32_t timestamp, std::string_view textData);
 
 private:
     bool isCodecHeader(RtmpMessage *m);
     void dumpAudioFormat(RtmpMessage *m);
     void dumpVideoFormat(RtmpMessage *m, uint8_t &frameType);
+    void onFrame(uint8_t type, RtmpMessage *m, bool keyFrame);
+    std::shared_ptr<StreamPacket> makePacket(uint8_t type, uint32_t timestamp, const FrameSlice &payload);
+    void cachePacket(const std::shared_ptr<StreamPacket> &p, bool keyFrame);
+    bool hasSubscribers();
+    void stopIdlePull();
+    void startPush(uint64_t epoch, std::size_t index);
+    void stopPush(std::shared_ptr<RtmpSession> c);
+    void broadcast(const std::shared_ptr<StreamPacket> &p);
+    void fanout(std::size_t worker, const std::shared_ptr<StreamPacket> &p);
+    void handoff(std::size_t worker, const std::shared_ptr<StreamPacket> &p);
+    void drain(std::size_t worker);
+
+    // subscribers living on one worker, the list is only touched from that worker's thread
+    struct alignas(64) Shard {
+        SpIntrusiveList<StreamSink> subs;
+        std::atomic<std::size_t> size{ 0 };
+        Counter bytesOut;
+        Counter messagesOut;
+        // packets from the publisher's worker, one task drains all that piled up
+        SpscQueue<std::shared_ptr<StreamPacket>> handoff;
+        std::atomic<bool> draining{ false };
+        bool skipVideo{ false }; // publisher's worker: the queue was full, video resumes at a key frame
+    };
 
 private:
+    Server &server_;
     std::string app_;
     std::string name_;
+    StreamKey key_;
+    std::size_t worker_;
+    std::unique_ptr<Shard[]> shards_;
+    std::atomic<bool> pullPending_{ false };
+    // written by the publisher's worker
+    Counter bytesIn_;
+    Counter messagesIn_;
+    std::mutex mutex_; // guards the publisher, its recorder and segmenter, the packet sequence and the caches
     std::shared_ptr<RtmpSession> pub_;
-    SpIntrusiveList<RtmpSession> subs_;
-    Buffer metaData_;
-    Buffer audioHeader_;
-    Buffer videoHeader_;
+    std::size_t pubWorker_{ 0 };
+    std::shared_ptr<Recorder> recorder_;
+    std::shared_ptr<HlsSegmenter> hls_;
+    bool hlsLive_{ false }; // hls_ is subscribed
+    // forwards to upstream servers, their sessions live on the publisher's worker
+    struct Push {
+        std::string target;
+        std::shared_ptr<RtmpSession> session;
+        bool subscribed{ false };
+        uint32_t failures{ 0 };
+    };
+    std::vector<Push> pushes_;
+    uint64_t epoch_{ 0 }; // number of publishings, a forward retry belongs to one
+    uint64_t seq_{ 0 };
+    std::shared_ptr<StreamPacket> metaData_;
+    std::shared_ptr<StreamPacket> audioHeader_;
+    std::shared_ptr<StreamPacket> videoHeader_;
+    // frames since the last video key frame, replayed to new subscribers
+    std::deque<std::shared_ptr<StreamPacket>> gop_;
+    std::size_t gopSize_{ 0 };
 };
 }
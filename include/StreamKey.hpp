@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+#include <string_view>
+
+namespace ms777 {
+// app and name of a stream with their hash computed once. The views point
+// into the caller's strings for a lookup, into the stream itself for the
+// key stored in the registry, so neither allocates.
+struct StreamKey {
+    std::string_view app;
+    std::string_view name;
+    std::size_t hash;
+
+    StreamKey(std::string_view app_, std::string_view name_)
+        : app(app_), name(name_), hash(std::hash<std::string_view>()(app_))
+    {
+        hash ^= std::hash<std::string_view>()(name_) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    }
+
+    bool operator==(const StreamKey &o) const
+    {
+        return hash == o.hash && app == o.app && name == o.name;
+    }
+
+    struct Hash {
+        std::size_t operator()(const StreamKey &k) const
+        {
+            return k.hash;
+        }
+    };
+};
+}
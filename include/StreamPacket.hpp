@@ -0,0 +1,17 @@
+#pragma once
+#include "Frame.hpp"
+
+namespace ms777 {
+// One message of a stream, immutable once built and shared by every subscriber,
+// cache and send queue. RTMP sessions chunk the payload in place and write their
+// own chunk headers between the chunks, without copying the payload.
+struct StreamPacket {
+    uint64_t seq{ 0 };
+    uint8_t type{ 0 };
+    uint8_t cid{ 0 };
+    uint32_t timestamp{ 0 };
+    bool keyFrame{ false };
+    bool header{ false }; // metadata or codec sequence header, never dropped
+    FrameSlice payload;
+};
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <memory>
+#include "StreamPacket.hpp"
+#include "Intrusive.hpp"
+#include "Metrics.hpp"
+
+namespace ms777 {
+// Anything a Stream fans packets out to: RTMP and HTTP-FLV viewers, ...
+// Called on the worker thread the sink subscribed from.
+class StreamSink : public SpIntrusiveList<StreamSink>::Hook
+{
+public:
+    virtual ~StreamSink() = default;
+
+    virtual void sendPacket(const std::shared_ptr<StreamPacket> &p) = 0;
+    // the stream is going away, close the sink
+    virtual void stop() = 0;
+    // adds the sink's samples, labels is "{app=...,name=..." without the closing brace
+    virtual void collectMetrics(const std::string &labels, SessionMetrics &out)
+    {
+    }
+
+    // sequence of the last stream packet replayed to this sink when it joined
+    uint64_t joinSeq()
+    {
+        return joinSeq_;
+    }
+
+    void setJoinSeq(uint64_t seq)
+    {
+        joinSeq_ = seq;
+    }
+
+private:
+    uint64_t joinSeq_{ 0 };
+};
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+namespace ms777 {
+// Coarse timers of one event loop on a hashed wheel: one steady_timer ticks
+// for all of them, a tick only visits the slot it lands on. Tasks check
+// their own deadlines when they run and ask to run again, so activity never
+// touches the wheel, it only updates a timestamp read from now().
+class TimerWheel
+{
+public:
+    // returns the ms until it wants to run again, 0 when done
+    using Task = std::function<uint32_t()>;
+
+    TimerWheel(boost::asio::io_context &io, uint32_t tickMs, uint32_t slots);
+
+    void start();
+    // drops every task
+    void stop();
+
+    // runs the task on the loop after at least ms, rounded up to a tick
+    void schedule(uint32_t ms, Task task);
+
+    // ms since start() as of the last tick, a clock read once per tick
+    uint64_t now() const
+    {
+        return now_;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    // ms per tick, the shortest delay a task can ask for
+    uint32_t tick() const
+    {
+        return tickMs_;
+    }
+
+private:
+    struct Entry {
+        uint64_t due; // now() it runs at
+        Task task;
+    };
+
+    void doTick();
+    void onTick();
+    void insert(Entry entry);
+
+private:
+    boost::asio::steady_timer timer_;
+    std::chrono::steady_clock::time_point start_;
+    uint32_t tickMs_;
+    std::vector<std::vector<Entry>> slots_;
+    std::vector<Entry> expired_; // slot being run, kept for its capacity
+    uint64_t tick_{ 0 }; // ticks run since start()
+    uint64_t now_{ 0 };
+    std::size_t size_{ 0 };
+    bool stopped_{ true };
+};
+}
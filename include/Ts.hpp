@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include "Buffer.hpp"
+
+namespace ms777::ts {
+constexpr uint32_t PACKET_SIZE = 188;
+constexpr uint16_t PID_PAT = 0;
+constexpr uint16_t PID_PMT = 0x1000;
+constexpr uint16_t PID_VIDEO = 0x100;
+constexpr uint16_t PID_AUDIO = 0x101;
+constexpr uint8_t STREAM_TYPE_AAC = 0x0f;
+constexpr uint8_t STREAM_TYPE_H264 = 0x1b;
+constexpr uint8_t STREAM_ID_AUDIO = 0xc0;
+constexpr uint8_t STREAM_ID_VIDEO = 0xe0;
+
+uint32_t crc32(const uint8_t *data, uint32_t size);
+
+// Writes MPEG-TS packets for one program with an H.264 and/or an AAC stream,
+// the continuity counters carry on from one segment to the next.
+class Muxer
+{
+public:
+    // PAT and PMT, at the start of every segment
+    void writeTables(Buffer &output, bool video, bool audio);
+    // one PES, with timestamps in 90 kHz units
+    void writePes(Buffer &output, uint16_t pid, uint8_t streamId, uint64_t pts, uint64_t dts,
+                  bool pcr, bool randomAccess, const uint8_t *data, uint32_t size);
+
+private:
+    void writeSection(Buffer &output, uint16_t pid, const uint8_t *section, uint32_t size);
+    uint8_t nextCounter(uint16_t pid);
+
+private:
+    uint8_t counters_[4] = {}; // PAT, PMT, video, audio
+};
+}
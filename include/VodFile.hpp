@@ -0,0 +1,79 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <vector>
+#include "Frame.hpp"
+
+namespace ms777 {
+// A recorded FLV file mapped read-only, with the index of its key frames.
+// Built once and shared by every session playing it, tags are read in
+// place and sent as slices of the mapping.
+class VodFile
+{
+public:
+    struct Tag {
+        uint8_t type;
+        uint32_t timestamp;
+        uint32_t offset; // of the body
+        uint32_t size;
+        bool keyFrame;
+        bool header; // metadata or codec sequence header
+    };
+
+    // maps and indexes the file, null if it is not a readable FLV file or still recorded
+    static std::shared_ptr<VodFile> open(const std::string &path);
+
+    ~VodFile();
+
+    const std::string &path()
+    {
+        return path_;
+    }
+
+    // the whole mapping, tag bodies are slices of it
+    const FramePtr &data()
+    {
+        return data_;
+    }
+
+    // false once the file was cut shorter than its mapping, reading it would fault
+    bool intact() const;
+    // the tag at offset and the offset of the one after, false past the last complete tag
+    bool tag(uint32_t offset, Tag &t, uint32_t &next) const;
+    // offset of the last key frame at or before ms, its timestamp in timestamp
+    uint32_t seek(uint32_t ms, uint32_t &timestamp) const;
+
+    // metadata and codec headers found before the first frame
+    const std::vector<uint32_t> &headers()
+    {
+        return headers_;
+    }
+
+    uint32_t duration()
+    {
+        return duration_;
+    }
+
+    std::size_t keyFrames()
+    {
+        return index_.size();
+    }
+
+private:
+    struct KeyFrame {
+        uint32_t timestamp;
+        uint32_t offset; // of the tag
+    };
+
+    void buildIndex();
+
+private:
+    std::string path_;
+    int fd_{ -1 }; // open to check the size, unused on windows
+    FramePtr data_;
+    uint32_t first_{ 0 }; // offset of the first tag
+    std::vector<uint32_t> headers_;
+    std::vector<KeyFrame> index_;
+    uint32_t duration_{ 0 };
+};
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <memory>
+#include "StreamPacket.hpp"
+#include "VodFile.hpp"
+
+namespace ms777 {
+// Playback position in a VodFile for one session. Tags come out as packets
+// paced by their timestamps against the caller's clock, running up to
+// --vod_buffer_time ahead of it, with payloads pointing into the mapping.
+class VodPlayer
+{
+public:
+    VodPlayer(std::shared_ptr<VodFile> file);
+
+    // restarts at the last key frame at or before ms, after the file's headers
+    void seek(uint32_t ms, uint64_t now);
+    // the next packet due at now in ms, null if none is due yet or the file ended
+    std::shared_ptr<StreamPacket> next(uint64_t now);
+
+    bool ended()
+    {
+        return ended_;
+    }
+
+    const std::shared_ptr<VodFile> &file()
+    {
+        return file_;
+    }
+
+private:
+    std::shared_ptr<StreamPacket> makePacket(const VodFile::Tag &t);
+
+private:
+    std::shared_ptr<VodFile> file_;
+    std::size_t header_{ 0 }; // next of the file's headers to send
+    uint32_t offset_{ 0 }; // next tag
+    uint32_t base_{ 0 }; // timestamp playback started from
+    uint64_t clock_{ 0 }; // caller's time it started at
+    uint64_t seq_{ 0 };
+    bool ended_{ false };
+};
+}
@@ -1,22 +1,24 @@
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <utility>
 #include "Buffer.hpp"
+#include "BufferPool.hpp"
 
 namespace ms777 {
 
-Buffer::Buffer() : capacity_(0), readPos_(0), writePos_(0)
+Buffer::Buffer() : start_(nullptr), capacity_(0), readPos_(0), writePos_(0)
 {
 }
 
 Buffer::Buffer(uint32_t capacity) : capacity_(capacity), readPos_(0), writePos_(0)
 {
-    start_ = new uint8_t[capacity_];
+    start_ = BufferPool::allocate(capacity_);
 }
 
 Buffer::~Buffer()
 {
-    delete []start_;
+    BufferPool::release(start_, capacity_);
 }
 
 void Buffer::clear()
@@ -32,17 +34,17 @@ void Buffer::swap(Buffer &other)
     std::swap(writePos_, other.writePos_);
 }
 
-const uint8_t *Buffer::readBuffer()
+const uint8_t *Buffer::readBuffer() const
 {
     return start_ + readPos_;
 }
 
-uint32_t Buffer::readableSize()
+uint32_t Buffer::readableSize() const
 {
     return writePos_ - readPos_;
 }
 
-std::string_view Buffer::stringView()
+std::string_view Buffer::stringView() const
 {
     return std::string_view((const char *)readBuffer(), readableSize());
 }
@@ -75,7 +77,8 @@ void Buffer::reserve(uint32_t n)
     if((capacity_ - (writePos_ - readPos_)) >= n) {
         normalize();
     } else {
-        uint32_t newCapacity = (writePos_ - readPos_) + n;
+        // grow geometrically, so repeated appends copy in amortized linear time
+        uint32_t newCapacity = std::max((writePos_ - readPos_) + n, capacity_ * 2);
         Buffer newBuffer(newCapacity);
         newBuffer.append(readBuffer(), readableSize());
         swap(newBuffer);
@@ -0,0 +1,90 @@
+#include <cassert>
+#include "BufferPool.hpp"
+#include "Conf.hpp"
+
+namespace ms777 {
+namespace {
+constexpr uint32_t MIN_CLASS_SHIFT = 6;
+constexpr uint32_t CLASSES = 17; // 64 bytes to 4 MB
+static_assert((BufferPool::MIN_CLASS_SIZE << (CLASSES - 1)) == BufferPool::MAX_CLASS_SIZE);
+
+struct FreeBlock {
+    FreeBlock *next;
+};
+
+struct ThreadCache {
+    FreeBlock *lists[CLASSES] = {};
+    BufferPool::Stats stats;
+
+    ~ThreadCache()
+    {
+        for(uint32_t c = 0; c < CLASSES; c++) {
+            while(lists[c]) {
+                FreeBlock *b = lists[c];
+                lists[c] = b->next;
+                delete [](uint8_t *)b;
+            }
+        }
+        alive = false;
+    }
+
+    // trivially destructible, still readable while other thread locals are destroyed
+    static thread_local bool alive;
+};
+
+thread_local bool ThreadCache::alive = true;
+thread_local ThreadCache cache;
+
+uint32_t sizeClass(uint32_t size)
+{
+    uint32_t c = 0;
+    while((BufferPool::MIN_CLASS_SIZE << c) < size) {
+        c++;
+    }
+    return c;
+}
+}
+
+uint8_t *BufferPool::allocate(uint32_t &capacity)
+{
+    if(capacity > MAX_CLASS_SIZE) {
+        return new uint8_t[capacity];
+    }
+    uint32_t c = sizeClass(capacity);
+    capacity = MIN_CLASS_SIZE << c;
+    if(ThreadCache::alive) {
+        FreeBlock *b = cache.lists[c];
+        if(b) {
+            cache.lists[c] = b->next;
+            cache.stats.cachedBytes -= capacity;
+            cache.stats.hits++;
+            return (uint8_t *)b;
+        }
+        cache.stats.misses++;
+    }
+    return new uint8_t[capacity];
+}
+
+void BufferPool::release(uint8_t *data, uint32_t capacity)
+{
+    if(!data) {
+        return;
+    }
+    if(capacity > MAX_CLASS_SIZE || !ThreadCache::alive
+       || cache.stats.cachedBytes + capacity > FLAGS_buffer_pool_max_size) {
+        delete []data;
+        return;
+    }
+    uint32_t c = sizeClass(capacity);
+    assert((MIN_CLASS_SIZE << c) == capacity);
+    FreeBlock *b = (FreeBlock *)data;
+    b->next = cache.lists[c];
+    cache.lists[c] = b;
+    cache.stats.cachedBytes += capacity;
+}
+
+const BufferPool::Stats &BufferPool::stats()
+{
+    return cache.stats;
+}
+}
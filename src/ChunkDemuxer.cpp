@@ -0,0 +1,184 @@
+#include <algorithm>
+#include <spdlog/spdlog.h>
+#include "ChunkDemuxer.hpp"
+#include "Endian.hpp"
+#include "Rtmp.hpp"
+
+namespace ms777 {
+ChunkDemuxer::Result ChunkDemuxer::decode(const uint8_t *data, uint32_t size, uint32_t &consumed)
+{
+    release();
+    consumed = 0;
+    if(readingHeader_) {
+        return decodeHeader(data, size, consumed);
+    }
+    consumed = std::min(size, pendingPayload());
+    current_->payload->buffer().append(data, consumed);
+    return onPayload(current_);
+}
+
+uint32_t ChunkDemuxer::pendingPayload()
+{
+    if(readingHeader_) {
+        return 0;
+    }
+    uint32_t received = current_->payload->readableSize();
+    return std::min(current_->h.length - received, chunkSize_ - (received % chunkSize_));
+}
+
+uint8_t *ChunkDemuxer::payloadBuffer()
+{
+    // reserved for the whole message by decodeHeader, this only guards against a short reservation
+    auto &buffer = current_->payload->buffer();
+    buffer.reserve(pendingPayload());
+    return buffer.writeBuffer();
+}
+
+ChunkDemuxer::Result ChunkDemuxer::commitPayload(uint32_t size)
+{
+    release();
+    current_->payload->buffer().commit(size);
+    return onPayload(current_);
+}
+
+ChunkDemuxer::Result ChunkDemuxer::decodeHeader(const uint8_t *data, uint32_t size, uint32_t &consumed)
+{
+    uint32_t offset = 0, readableSize = size;
+    // chunk flags
+    if(readableSize < 1) {
+        return Result::NEED_MORE;
+    }
+    uint8_t flags = *(data + offset);
+    uint8_t fmt = flags >> 6;
+    uint32_t cid = flags & 0x3f;
+    offset += 1;
+    readableSize -= 1;
+    // possible cid >= 64
+    if(cid == 0) {
+        if(readableSize < 1) {
+            return Result::NEED_MORE;
+        }
+        cid = 64 + (uint16_t) * (data + offset);
+        offset += 1;
+        readableSize -= 1;
+    } else if(cid == 1) {
+        if(readableSize < 2) {
+            return Result::NEED_MORE;
+        }
+        uint16_t cid16;
+        loadLE<uint16_t, 16>(data + offset, cid16);
+        cid = 64 + cid16;
+        offset += 2;
+        readableSize -= 2;
+    }
+    // chunk header: 11/7/3/0 bytes
+    if(readableSize < rtmp::ChunkHeaderSize[fmt]) {
+        return Result::NEED_MORE;
+    }
+    // new or previous message slot
+    auto m = getMessage(cid);
+    if(!m) {
+        error_ = fmt::format("cannot get message slot for cid={}", cid);
+        return Result::ERROR;
+    }
+    // fields are only stored once the whole header is there
+    RtmpMessageHeader h = m->h;
+    if(fmt <= rtmp::CHUNK_TYPE_2) {
+        loadBE<uint32_t, 24>(data + offset, h.timestamp);
+        offset += 3;
+        readableSize -= 3;
+    }
+    if(fmt <= rtmp::CHUNK_TYPE_1) {
+        loadBE<uint32_t, 24>(data + offset, h.length);
+        offset += 3;
+        readableSize -= 3;
+        loadBE<uint8_t, 8>(data + offset, h.type);
+        offset += 1;
+        readableSize -= 1;
+    }
+    if(fmt == rtmp::CHUNK_TYPE_0) {
+        loadLE<uint32_t, 32>(data + offset, h.sid);
+        offset += 4;
+        readableSize -= 4;
+    }
+    if(h.type > rtmp::TYPE_METADATA) {
+        error_ = fmt::format("invalid message type {}", h.type);
+        return Result::ERROR;
+    }
+    // possible extended timestamp
+    uint32_t extended = h.timestamp;
+    if(h.timestamp == rtmp::EXTENDED_TIMESTAMP) {
+        if(readableSize < 4) {
+            return Result::NEED_MORE;
+        }
+        loadBE<uint32_t, 32>(data + offset, extended);
+        offset += 4;
+        readableSize -= 4;
+    }
+    // a message cannot change shape halfway, the reassembled bytes were sized for it
+    if(m->payload && m->payload->readableSize() > 0 && (h.length != m->h.length || h.type != m->h.type)) {
+        error_ = fmt::format("chunk header for cid={} changes length {}->{} or type {}->{} of a partly received message",
+                             cid, m->h.length, h.length, m->h.type, h.type);
+        return Result::ERROR;
+    }
+    m->h = h;
+    // initialize the message, in case of first chunk
+    if(!m->payload) {
+        m->payload = Frame::create(m->h.length);
+    }
+    if(m->payload->readableSize() == 0) {
+        if(rtmp::CHUNK_TYPE_0 == fmt) {
+            m->h.clock = extended;
+        } else {
+            m->h.clock += extended;
+        }
+        m->payload->buffer().reserve(m->h.length);
+    }
+    consumed = offset;
+    current_ = m;
+    readingHeader_ = false;
+    // a zero length message has no body to wait for
+    return m->h.length == 0 ? onPayload(m) : Result::CHUNK;
+}
+
+ChunkDemuxer::Result ChunkDemuxer::onPayload(RtmpMessage *m)
+{
+    if(m->payload->readableSize() >= m->h.length) {
+        message_ = m;
+        readingHeader_ = true;
+        return Result::MESSAGE;
+    }
+    if(0 == (m->payload->readableSize() % chunkSize_)) {
+        readingHeader_ = true;
+    }
+    // else incomplete chunk body, keep state
+    return Result::CHUNK;
+}
+
+void ChunkDemuxer::release()
+{
+    if(message_) {
+        // never reused in place: streams and send queues on other workers may still be
+        // dropping their references, use_count says nothing about when they are done;
+        // the storage goes back to the BufferPool with the last of them
+        message_->payload.reset();
+        message_ = nullptr;
+    }
+}
+
+RtmpMessage *ChunkDemuxer::getMessage(uint32_t cid)
+{
+    uint32_t pos = cid % RTMP_MAX_CHANNELS;
+    if(messages_[pos].h.cid == 0 || messages_[pos].h.cid == cid) {
+        messages_[pos].h.cid = cid;
+        return &messages_[pos];
+    }
+    for(pos = 0; pos < RTMP_MAX_CHANNELS; pos++) {
+        if(messages_[pos].h.cid == 0) {
+            messages_[pos].h.cid = cid;
+            return &messages_[pos];
+        }
+    }
+    return nullptr;
+}
+}
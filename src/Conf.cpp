@@ -1,9 +1,55 @@
 #include "Conf.hpp"
 
 DEFINE_string(log_level, "info", "log level (debug, info, warn, error, critical, off)");
+DEFINE_uint32(server_threads, 1, "number of worker threads, each with its own event loop and acceptor (0 = one per core)");
+DEFINE_uint32(buffer_pool_max_size, 64 * 1024 * 1024, "max bytes of free buffers cached per thread for reuse");
 
 DEFINE_string(rtmp_server_ip, "0.0.0.0", "rtmp server ip address");
 DEFINE_int32(rtmp_server_port, 1935, "rtmp server port");
 DEFINE_uint32(rtmp_read_buffer_size, 8192, "rtmp buffer size");
+DEFINE_uint32(rtmp_direct_read_size, 8192, "rtmp read pending chunk bodies of at least this many bytes straight into the message (0 = never)");
 DEFINE_uint32(rtmp_chunk_size, 4096, "rtmp chunk size");
+DEFINE_uint32(rtmp_write_max_iovecs, 64, "rtmp max buffer segments per vectored write");
+DEFINE_uint32(rtmp_write_max_bytes, 256 * 1024, "rtmp max bytes per vectored write");
+DEFINE_uint32(rtmp_sub_queue_max_size, 32 * 1024 * 1024, "rtmp subscriber send queue limit in bytes before dropping frames (0 = unlimited)");
+DEFINE_uint32(rtmp_sub_queue_max_duration, 20000, "rtmp subscriber send queue limit in ms of media before dropping frames (0 = unlimited)");
+DEFINE_uint32(rtmp_handoff_max_packets, 2048, "rtmp packets of a stream waiting for another worker before its media is dropped (0 = unlimited)");
+DEFINE_uint32(rtmp_sub_evict_timeout, 30000, "rtmp close subscribers staying over the queue limit for this many ms (0 = never)");
+DEFINE_uint32(rtmp_handshake_timeout, 10000, "rtmp close connections not publishing or playing after this many ms (0 = never)");
+DEFINE_uint32(rtmp_idle_timeout, 30000, "rtmp close publishers and pulls silent for this many ms (0 = never)");
+DEFINE_uint32(rtmp_write_timeout, 30000, "rtmp close sessions whose pending write makes no progress for this many ms (0 = never)");
 DEFINE_bool(rtmp_gop_cache, true, "rtmp enable GOP cache");
+DEFINE_uint32(rtmp_gop_cache_max_size, 16 * 1024 * 1024, "rtmp GOP cache memory budget per stream in bytes");
+DEFINE_uint32(stream_idle_timeout, 30000, "ms a stream without publisher and subscribers is kept before it is reclaimed (0 = never)");
+
+DEFINE_string(http_server_ip, "0.0.0.0", "http server ip address");
+DEFINE_int32(http_server_port, 8080, "http server port for HTTP-FLV and HLS (0 = disabled)");
+
+DEFINE_string(record_path, "record", "directory of FLV recordings, one sub directory per app");
+DEFINE_string(record_streams, "", "comma separated app/name patterns to record, * and ? wildcards (empty = none)");
+DEFINE_uint32(record_segment_size, 512 * 1024 * 1024, "start a new recording file at the next key frame past this many bytes (0 = unlimited)");
+DEFINE_uint32(record_segment_duration, 3600 * 1000, "start a new recording file at the next key frame past this many ms (0 = unlimited)");
+DEFINE_uint32(record_batch_size, 1024 * 1024, "bytes of media batched into one disk write");
+DEFINE_uint32(record_flush_interval, 2000, "ms of media after which a partial batch is written anyway");
+DEFINE_uint32(record_queue_max_size, 64 * 1024 * 1024, "bytes waiting for the disk per recording before frames are dropped");
+DEFINE_uint32(record_threads, 1, "threads writing recordings to disk");
+
+DEFINE_string(vod_path, "", "directory of FLV files played on demand, names are paths below it (empty = disabled)");
+DEFINE_string(vod_app, "vod", "app whose play names are files under vod_path instead of live streams");
+DEFINE_uint32(vod_buffer_time, 1000, "ms of media sent ahead of the playback clock to on demand players");
+DEFINE_uint32(vod_cache_size, 64, "indexed on demand files kept mapped for later plays");
+
+DEFINE_string(hls_streams, "", "comma separated app/name patterns to serve as HLS, * and ? wildcards (empty = none)");
+DEFINE_uint32(hls_fragment, 4000, "start a new HLS segment at the next key frame past this many ms");
+DEFINE_uint32(hls_playlist_length, 6, "number of segments listed in the HLS playlist");
+
+DEFINE_string(edge_origin, "", "origin server host[:port], streams played but not published here are pulled from it (empty = not an edge)");
+DEFINE_uint32(edge_retry_interval, 3000, "ms to wait before pulling again when the origin connection fails or ends");
+
+DEFINE_string(forward_targets, "", "comma separated app=host[:port] entries, streams published under app are forwarded to host (empty = none)");
+DEFINE_uint32(forward_retry_min, 1000, "ms to wait before reconnecting a failed forward, doubled on every failure");
+DEFINE_uint32(forward_retry_max, 30000, "max ms to wait before reconnecting a failed forward");
+
+DEFINE_string(metrics_path, "/metrics", "HTTP path of the Prometheus metrics (empty = disabled)");
+DEFINE_bool(metrics_local_only, true, "only answer metrics requests from loopback addresses");
+DEFINE_bool(metrics_sessions, false, "export counters per session as well, one series per connection");
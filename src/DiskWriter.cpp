@@ -0,0 +1,57 @@
+#include <spdlog/spdlog.h>
+#include "DiskWriter.hpp"
+
+namespace ms777 {
+DiskWriter::DiskWriter(std::size_t threads)
+{
+    for(std::size_t i = 0; i < std::max<std::size_t>(1, threads); i++) {
+        auto w = std::make_unique<Worker>();
+        w->thread = std::thread([this, p = w.get()]() {
+            run(*p);
+        });
+        workers_.push_back(std::move(w));
+    }
+}
+
+DiskWriter::~DiskWriter()
+{
+    for(auto &w : workers_) {
+        {
+            std::lock_guard<std::mutex> lock(w->mutex);
+            w->stopping = true;
+        }
+        w->cv.notify_one();
+    }
+    for(auto &w : workers_) {
+        w->thread.join();
+    }
+}
+
+void DiskWriter::post(std::size_t key, std::function<void()> task)
+{
+    Worker &w = *workers_[key % workers_.size()];
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.tasks.push_back(std::move(task));
+    }
+    w.cv.notify_one();
+}
+
+void DiskWriter::run(Worker &w)
+{
+    std::unique_lock<std::mutex> lock(w.mutex);
+    while(true) {
+        w.cv.wait(lock, [&w]() {
+            return w.stopping || !w.tasks.empty();
+        });
+        if(w.tasks.empty()) {
+            break;
+        }
+        auto task = std::move(w.tasks.front());
+        w.tasks.pop_front();
+        lock.unlock();
+        task();
+        lock.lock();
+    }
+}
+}
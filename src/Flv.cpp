@@ -0,0 +1,24 @@
+#include "Flv.hpp"
+#include "Endian.hpp"
+#include "Rtmp.hpp"
+
+namespace ms777::flv {
+uint32_t encodeTagHeader(uint8_t *output, uint8_t type, uint32_t size, uint32_t timestamp)
+{
+    storeBE<uint8_t, 8>(output, type);
+    storeBE<uint32_t, 24>(output + 1, size);
+    storeBE<uint32_t, 24>(output + 4, timestamp & 0xffffff);
+    storeBE<uint8_t, 8>(output + 7, timestamp >> 24); // timestamp extended
+    storeBE<uint32_t, 24>(output + 8, 0); // stream id
+    return TAG_HEADER_SIZE;
+}
+
+FrameSlice tagBody(const StreamPacket &p)
+{
+    static constexpr std::string_view setDataFrame("\x02\x00\x0d@setDataFrame", 16);
+    if(p.type == rtmp::TYPE_DATA && p.payload.stringView().substr(0, setDataFrame.size()) == setDataFrame) {
+        return p.payload.slice(setDataFrame.size(), p.payload.size() - setDataFrame.size());
+    }
+    return p.payload;
+}
+}
@@ -0,0 +1,91 @@
+#include <cassert>
+#include "Frame.hpp"
+
+namespace ms777 {
+Frame::Frame(uint32_t capacity) : data_(capacity)
+{
+}
+
+Frame::Frame(const uint8_t *data, uint32_t size, std::shared_ptr<const void> owner)
+    : external_(data), externalSize_(size), owner_(std::move(owner))
+{
+}
+
+std::shared_ptr<Frame> Frame::create(uint32_t capacity)
+{
+    return std::make_shared<Frame>(capacity);
+}
+
+std::shared_ptr<Frame> Frame::wrap(const uint8_t *data, uint32_t size, std::shared_ptr<const void> owner)
+{
+    return std::make_shared<Frame>(data, size, std::move(owner));
+}
+
+Buffer &Frame::buffer()
+{
+    return data_;
+}
+
+const uint8_t *Frame::readBuffer() const
+{
+    return external_ ? external_ : data_.readBuffer();
+}
+
+uint32_t Frame::readableSize() const
+{
+    return external_ ? externalSize_ : data_.readableSize();
+}
+
+std::string_view Frame::stringView() const
+{
+    return std::string_view((const char *)readBuffer(), readableSize());
+}
+
+FrameSlice::FrameSlice() : offset_(0), length_(0)
+{
+}
+
+FrameSlice::FrameSlice(FramePtr frame)
+    : frame_(std::move(frame)), offset_(0), length_(frame_ ? frame_->readableSize() : 0)
+{
+}
+
+FrameSlice::FrameSlice(FramePtr frame, uint32_t offset, uint32_t length)
+    : frame_(std::move(frame)), offset_(offset), length_(length)
+{
+    assert(frame_ && (offset_ + length_) <= frame_->readableSize());
+}
+
+FrameSlice FrameSlice::slice(uint32_t offset, uint32_t length) const
+{
+    assert((offset + length) <= length_);
+    return FrameSlice(frame_, offset_ + offset, length);
+}
+
+FrameSlice FrameSlice::slice(std::string_view view) const
+{
+    const char *begin = (const char *)data();
+    assert(view.data() >= begin && (view.data() + view.size()) <= (begin + length_));
+    return slice(view.data() - begin, view.size());
+}
+
+const uint8_t *FrameSlice::data() const
+{
+    return frame_ ? frame_->readBuffer() + offset_ : nullptr;
+}
+
+uint32_t FrameSlice::size() const
+{
+    return length_;
+}
+
+bool FrameSlice::empty() const
+{
+    return 0 == length_;
+}
+
+std::string_view FrameSlice::stringView() const
+{
+    return std::string_view((const char *)data(), length_);
+}
+}
@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <spdlog/spdlog.h>
+#include "HlsSegmenter.hpp"
+#include "Rtmp.hpp"
+#include "Conf.hpp"
+
+namespace ms777 {
+constexpr uint8_t CODEC_AVC = 7;
+constexpr uint8_t CODEC_AAC = 10;
+constexpr uint8_t ANNEXB_START_CODE[] = { 0, 0, 0, 1 };
+// access unit delimiter, any slice type
+constexpr uint8_t ANNEXB_AUD[] = { 0, 0, 0, 1, 0x09, 0xf0 };
+constexpr uint32_t ADTS_HEADER_SIZE = 7;
+
+namespace {
+// ms from one timestamp to a later one, negative when timestamps step back
+int64_t elapsed(uint32_t from, uint32_t to)
+{
+    return static_cast<int32_t>(to - from);
+}
+}
+
+HlsSegmenter::HlsSegmenter(const std::string &app, const std::string &name)
+    : app_(app), name_(name)
+{
+    SPDLOG_INFO("HLS {} created for {}/{}", (void *)this, app, name);
+}
+
+HlsSegmenter::HlsSegmenter(const std::string &app, const std::string &name, HlsSegmenter &previous)
+    : HlsSegmenter(app, name)
+{
+    // players polling the playlist must never see the media sequence go back
+    {
+        std::lock_guard<std::mutex> lock(previous.mutex_);
+        segments_ = previous.segments_;
+        discontinuities_ = previous.discontinuities_;
+        nextSeq_ = previous.nextSeq_;
+    }
+    discontinuity_ = nextSeq_ > 0;
+    if(!segments_.empty()) {
+        updatePlaylist(false);
+    }
+}
+
+HlsSegmenter::~HlsSegmenter()
+{
+    SPDLOG_INFO("HLS {} is closed", (void *)this);
+}
+
+void HlsSegmenter::sendPacket(const std::shared_ptr<StreamPacket> &p)
+{
+    if(stopped_ || p->payload.size() < 2) {
+        return;
+    }
+    if(p->type == rtmp::TYPE_VIDEO) {
+        if(p->header) {
+            onVideoHeader(*p);
+        } else {
+            onVideo(*p);
+        }
+    } else if(p->type == rtmp::TYPE_AUDIO) {
+        if(p->header) {
+            onAudioHeader(*p);
+        } else {
+            onAudio(*p);
+        }
+    }
+}
+
+void HlsSegmenter::onVideoHeader(const StreamPacket &p)
+{
+    // AVCDecoderConfigurationRecord after the 5 bytes of the FLV video tag header
+    const uint8_t *data = p.payload.data();
+    uint32_t size = p.payload.size();
+    lengthSize_ = 0;
+    parameterSets_.clear();
+    if((data[0] & 0x0f) != CODEC_AVC || size < 11) {
+        SPDLOG_WARN("HLS {}, video codec {} is not supported", (void *)this, data[0] & 0x0f);
+        return;
+    }
+    uint32_t pos = 10;
+    for(int set = 0; set < 2; set++) {
+        // SPS count has 5 bits, PPS count 8
+        if(pos >= size) {
+            return;
+        }
+        uint32_t count = set == 0 ? (data[pos] & 0x1f) : data[pos];
+        pos++;
+        for(uint32_t i = 0; i < count; i++) {
+            uint16_t length;
+            if(pos + 2 > size) {
+                return;
+            }
+            loadBE<uint16_t, 16>(data + pos, length);
+            pos += 2;
+            if(pos + length > size) {
+                return;
+            }
+            parameterSets_.append(ANNEXB_START_CODE, sizeof(ANNEXB_START_CODE));
+            parameterSets_.append(data + pos, length);
+            pos += length;
+        }
+    }
+    lengthSize_ = (data[9] & 0x03) + 1;
+}
+
+void HlsSegmenter::onAudioHeader(const StreamPacket &p)
+{
+    // AudioSpecificConfig after the 2 bytes of the FLV audio tag header
+    const uint8_t *data = p.payload.data();
+    hasAudio_ = false;
+    if(((data[0] & 0xf0) >> 4) != CODEC_AAC || p.payload.size() < 4) {
+        SPDLOG_WARN("HLS {}, audio codec {} is not supported", (void *)this, (data[0] & 0xf0) >> 4);
+        return;
+    }
+    aacObjectType_ = data[2] >> 3;
+    aacFrequency_ = ((data[2] & 0x07) << 1) | (data[3] >> 7);
+    aacChannels_ = (data[3] >> 3) & 0x0f;
+    hasAudio_ = aacObjectType_ > 0 && aacObjectType_ <= 4;
+}
+
+bool HlsSegmenter::splitPoint(const StreamPacket &p)
+{
+    // audio only streams can be split anywhere
+    return lengthSize_ > 0 ? (p.type == rtmp::TYPE_VIDEO && p.keyFrame) : p.type == rtmp::TYPE_AUDIO;
+}
+
+void HlsSegmenter::onVideo(const StreamPacket &p)
+{
+    const uint8_t *data = p.payload.data();
+    uint32_t size = p.payload.size();
+    if(lengthSize_ == 0 || (data[0] & 0x0f) != CODEC_AVC || data[1] != 1 || size < 5) {
+        return;
+    }
+    if(!segmentOpen_) {
+        // players need a key frame at the start of every segment
+        if(!p.keyFrame) {
+            return;
+        }
+        openSegment(p.timestamp);
+    } else if(p.keyFrame && elapsed(segmentStart_, p.timestamp) >= FLAGS_hls_fragment) {
+        closeSegment(p.timestamp);
+        openSegment(p.timestamp);
+    }
+    // AVCC to Annex B, starting with an AUD and the parameter sets on key frames
+    int32_t cts = (int32_t)((data[2] << 16) | (data[3] << 8) | data[4]);
+    if(cts & 0x800000) {
+        cts -= 0x1000000;
+    }
+    es_.clear();
+    es_.append(ANNEXB_AUD, sizeof(ANNEXB_AUD));
+    if(p.keyFrame) {
+        es_.append(parameterSets_.readBuffer(), parameterSets_.readableSize());
+    }
+    uint32_t pos = 5;
+    while(pos + lengthSize_ <= size) {
+        uint32_t length = 0;
+        for(uint8_t i = 0; i < lengthSize_; i++) {
+            length = (length << 8) | data[pos + i];
+        }
+        pos += lengthSize_;
+        if(length > size - pos) {
+            SPDLOG_WARN("HLS {}, truncated NAL unit", (void *)this);
+            break;
+        }
+        uint8_t nalType = data[pos] & 0x1f;
+        // already written above
+        if(length > 0 && nalType != 9) {
+            es_.append(ANNEXB_START_CODE, sizeof(ANNEXB_START_CODE));
+            es_.append(data + pos, length);
+        }
+        pos += length;
+    }
+    uint64_t dts = (uint64_t)p.timestamp * 90;
+    uint64_t pts = cts > 0 ? dts + (uint64_t)cts * 90 : dts;
+    muxer_.writePes(current_, ts::PID_VIDEO, ts::STREAM_ID_VIDEO, pts, dts, true, p.keyFrame,
+                    es_.readBuffer(), es_.readableSize());
+    lastTimestamp_ = p.timestamp;
+}
+
+void HlsSegmenter::onAudio(const StreamPacket &p)
+{
+    const uint8_t *data = p.payload.data();
+    uint32_t size = p.payload.size();
+    if(!hasAudio_ || ((data[0] & 0xf0) >> 4) != CODEC_AAC || data[1] != 1) {
+        return;
+    }
+    if(!segmentOpen_) {
+        // wait for the first key frame when there is video
+        if(lengthSize_ > 0) {
+            return;
+        }
+        openSegment(p.timestamp);
+    } else if(splitPoint(p) && elapsed(segmentStart_, p.timestamp) >= FLAGS_hls_fragment) {
+        closeSegment(p.timestamp);
+        openSegment(p.timestamp);
+    }
+    // raw AAC frame behind an ADTS header
+    uint32_t frameLength = ADTS_HEADER_SIZE + size - 2;
+    uint8_t adts[ADTS_HEADER_SIZE];
+    adts[0] = 0xff;
+    adts[1] = 0xf1; // MPEG-4, no CRC
+    adts[2] = ((aacObjectType_ - 1) << 6) | ((aacFrequency_ & 0x0f) << 2) | (aacChannels_ >> 2);
+    adts[3] = ((aacChannels_ & 0x03) << 6) | ((frameLength >> 11) & 0x03);
+    adts[4] = (frameLength >> 3) & 0xff;
+    adts[5] = ((frameLength & 0x07) << 5) | 0x1f;
+    adts[6] = 0xfc;
+    es_.clear();
+    es_.append(adts, sizeof(adts));
+    es_.append(data + 2, size - 2);
+    uint64_t pts = (uint64_t)p.timestamp * 90;
+    muxer_.writePes(current_, ts::PID_AUDIO, ts::STREAM_ID_AUDIO, pts, pts, lengthSize_ == 0, false,
+                    es_.readBuffer(), es_.readableSize());
+    lastTimestamp_ = p.timestamp;
+}
+
+void HlsSegmenter::openSegment(uint32_t timestamp)
+{
+    current_.clear();
+    muxer_.writeTables(current_, lengthSize_ > 0, hasAudio_);
+    segmentStart_ = timestamp;
+    lastTimestamp_ = timestamp;
+    segmentOpen_ = true;
+}
+
+void HlsSegmenter::closeSegment(uint32_t timestamp)
+{
+    auto f = Frame::create(0);
+    f->buffer().swap(current_);
+    segmentOpen_ = false;
+    uint32_t duration = static_cast<uint32_t>(std::max<int64_t>(elapsed(segmentStart_, timestamp), 0));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        segments_.push_back(Segment{ nextSeq_++, duration, FramePtr(std::move(f)), discontinuity_ });
+        // a few more than listed, for players still on the previous playlist
+        while(segments_.size() > FLAGS_hls_playlist_length + 2) {
+            discontinuities_ += segments_.front().discontinuity;
+            segments_.pop_front();
+        }
+    }
+    discontinuity_ = false;
+    updatePlaylist(false);
+}
+
+void HlsSegmenter::updatePlaylist(bool end)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t listed = std::min<std::size_t>(segments_.size(), std::max<uint32_t>(FLAGS_hls_playlist_length, 1));
+    auto first = segments_.end() - listed;
+    uint32_t target = 1;
+    for(auto i = first; i != segments_.end(); i++) {
+        target = std::max(target, (i->duration + 999) / 1000);
+    }
+    // the first listed segment carries its discontinuity in the sequence instead of a tag
+    uint64_t discontinuities = discontinuities_;
+    for(auto i = segments_.begin(); i != segments_.end() && i <= first; i++) {
+        discontinuities += i->discontinuity;
+    }
+    std::string m3u8 = "#EXTM3U\n"
+                       "#EXT-X-VERSION:3\n"
+                       "#EXT-X-TARGETDURATION:" + std::to_string(target) + "\n"
+                       "#EXT-X-MEDIA-SEQUENCE:" + std::to_string(listed > 0 ? first->seq : 0) + "\n";
+    if(discontinuities > 0) {
+        m3u8 += "#EXT-X-DISCONTINUITY-SEQUENCE:" + std::to_string(discontinuities) + "\n";
+    }
+    char extinf[32];
+    for(auto i = first; i != segments_.end(); i++) {
+        if(i != first && i->discontinuity) {
+            m3u8 += "#EXT-X-DISCONTINUITY\n";
+        }
+        snprintf(extinf, sizeof(extinf), "#EXTINF:%u.%03u,\n", i->duration / 1000, i->duration % 1000);
+        m3u8 += extinf;
+        m3u8 += name_ + "-" + std::to_string(i->seq) + ".ts\n";
+    }
+    if(end) {
+        m3u8 += "#EXT-X-ENDLIST\n";
+    }
+    auto f = Frame::create(m3u8.size());
+    f->buffer().append(m3u8);
+    playlist_ = std::move(f);
+}
+
+FramePtr HlsSegmenter::playlist()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return playlist_;
+}
+
+FramePtr HlsSegmenter::segment(uint64_t seq)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(segments_.empty() || seq < segments_.front().seq || seq > segments_.back().seq) {
+        return nullptr;
+    }
+    return segments_[seq - segments_.front().seq].data;
+}
+
+void HlsSegmenter::stop()
+{
+    if(stopped_) {
+        return;
+    }
+    stopped_ = true;
+    // the last segment is cut short, the playlist stays until the next publish
+    if(segmentOpen_) {
+        closeSegment(lastTimestamp_);
+    }
+    updatePlaylist(true);
+}
+}
@@ -0,0 +1,129 @@
+#include <spdlog/spdlog.h>
+#include "HttpServer.hpp"
+#include "Server.hpp"
+#include "RtmpServer.hpp"
+#include "Metrics.hpp"
+#include "Conf.hpp"
+
+#if (defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)) && !defined(__CYGWIN__)
+#define MS777_HAS_REUSE_PORT 1
+#endif
+
+namespace ms777 {
+HttpServer::HttpServer(Server &server, std::size_t index)
+    : server_(server), index_(index), acceptor_(server.get_io_context(index))
+{
+}
+
+HttpServer::~HttpServer()
+{
+}
+
+void HttpServer::start()
+{
+    if(FLAGS_http_server_port == 0) {
+        return;
+    }
+#if !defined(MS777_HAS_REUSE_PORT)
+    // without SO_REUSEPORT the first worker accepts and hands sockets to the others
+    if(index_ > 0) {
+        return;
+    }
+#endif
+    boost::asio::ip::tcp::resolver resolver(server_.get_io_context(index_));
+    boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(FLAGS_http_server_ip,
+            std::to_string(FLAGS_http_server_port)).begin();
+    acceptor_.open(endpoint.protocol());
+    acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(MS777_HAS_REUSE_PORT)
+    typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+    acceptor_.set_option(reuse_port(true));
+#endif
+    acceptor_.bind(endpoint);
+    acceptor_.listen();
+    SPDLOG_INFO("HTTP server {} listening ({}:{})", index_, FLAGS_http_server_ip, FLAGS_http_server_port);
+    doAccept();
+}
+
+void HttpServer::stop()
+{
+    SPDLOG_INFO("Stop HTTP server {}, close all clients", index_);
+    acceptor_.close();
+    std::shared_ptr<HttpSession> c = sessions_.front();
+    while(c) {
+        c->stop();
+        c = SpIntrusiveList<HttpSession>::next(c);
+    }
+    sessions_.clear();
+}
+
+void HttpServer::doAccept()
+{
+#if defined(MS777_HAS_REUSE_PORT)
+    acceptor_.async_accept(
+    [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+        if(!acceptor_.is_open()) {
+            SPDLOG_DEBUG("HTTP server is closed, ignore new clients");
+            return;
+        }
+        if(!ec) {
+            startSession(std::move(socket));
+        }
+        doAccept();
+    });
+#else
+    static std::size_t nextWorker = 0;
+    std::size_t worker = nextWorker++ % server_.workers();
+    acceptor_.async_accept(server_.get_io_context(worker),
+    [this, worker](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+        if(!acceptor_.is_open()) {
+            SPDLOG_DEBUG("HTTP server is closed, ignore new clients");
+            return;
+        }
+        if(!ec) {
+            HttpServer *target = &server_.httpServer(worker);
+            boost::asio::post(server_.get_io_context(worker),
+            [target, s = std::make_shared<boost::asio::ip::tcp::socket>(std::move(socket))]() {
+                target->startSession(std::move(*s));
+            });
+        }
+        doAccept();
+    });
+#endif
+}
+
+void HttpServer::startSession(boost::asio::ip::tcp::socket socket)
+{
+    auto c = std::make_shared<HttpSession>(*this, std::move(socket));
+    Metrics::local().httpConnections.add();
+    sessions_.addFront(c);
+    c->start();
+}
+
+void HttpServer::stop(std::shared_ptr<HttpSession> c)
+{
+    SPDLOG_INFO("HTTP client {} is closed", (void *)c.get());
+    sessions_.erase(c);
+    c->stop();
+}
+
+std::shared_ptr<Stream> HttpServer::subscribe(std::shared_ptr<HttpSession> c, const std::string &app, const std::string &name)
+{
+    sessions_.erase(c);
+    auto s = server_.getStream(StreamKey(app, name));
+    s->subscribe(c);
+    server_.rtmpServer(index_).pull(s);
+    return s;
+}
+
+std::shared_ptr<HlsSegmenter> HttpServer::hls(const std::string &app, const std::string &name)
+{
+    auto s = server_.findStream(StreamKey(app, name));
+    return s ? s->hls() : nullptr;
+}
+
+void HttpServer::metrics(std::function<void(std::string)> done)
+{
+    Metrics::render(server_, std::move(done));
+}
+}
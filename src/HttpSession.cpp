@@ -0,0 +1,389 @@
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include "HttpServer.hpp"
+#include "HttpSession.hpp"
+#include "Flv.hpp"
+#include "Metrics.hpp"
+#include "Conf.hpp"
+
+namespace ms777 {
+constexpr std::size_t HTTP_MAX_REQUEST_SIZE = 8192;
+
+namespace {
+std::string_view trim(std::string_view s)
+{
+    while(!s.empty() && (s.front() == ' ' || s.front() == '\t')) {
+        s.remove_prefix(1);
+    }
+    while(!s.empty() && (s.back() == ' ' || s.back() == '\t')) {
+        s.remove_suffix(1);
+    }
+    return s;
+}
+
+bool equalsNoCase(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+        return ::tolower(static_cast<unsigned char>(x)) == ::tolower(static_cast<unsigned char>(y));
+    });
+}
+}
+
+HttpSession::HttpSession(HttpServer &server, boost::asio::ip::tcp::socket socket)
+    : server_(server),
+      socket_(std::move(socket)),
+      outBuffer_(1024),
+      sendQueue_(*this)
+{
+}
+
+void HttpSession::start()
+{
+    SPDLOG_INFO("HTTP session {}, wait request", (void *)this);
+    doReadRequest();
+}
+
+void HttpSession::stop()
+{
+    SPDLOG_INFO("HTTP session {}, close socket", (void *)this);
+    socket_.close();
+}
+
+void HttpSession::doReadRequest()
+{
+    auto self(shared_from_this());
+    boost::asio::async_read_until(socket_, boost::asio::dynamic_buffer(request_, HTTP_MAX_REQUEST_SIZE), "\r\n\r\n",
+    [this, self](const boost::system::error_code & ec, std::size_t n) {
+        if(!ec) {
+            requestSize_ = n;
+            if(!onRequest()) {
+                stopSession();
+            }
+        } else if(ec != boost::asio::error::operation_aborted) {
+            SPDLOG_ERROR("HTTP session {}, fail to read request", (void *)this);
+            stopSession();
+        }
+    });
+}
+
+bool HttpSession::onRequest()
+{
+    // request line: GET /app/name.flv HTTP/1.1, only the Connection field is needed
+    std::string_view request(request_.data(), requestSize_);
+    std::size_t eol = request.find("\r\n");
+    std::string_view line = request.substr(0, eol);
+    std::size_t sp1 = line.find(' ');
+    std::size_t sp2 = sp1 == std::string_view::npos ? sp1 : line.find(' ', sp1 + 1);
+    if(sp1 == 0 || sp2 == std::string_view::npos || sp2 == sp1 + 1) {
+        SPDLOG_ERROR("HTTP session {}, invalid request line", (void *)this);
+        return false;
+    }
+    std::string_view method = line.substr(0, sp1);
+    std::string_view path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string_view version = line.substr(sp2 + 1);
+    if(version.size() < 8 || version.substr(0, 5) != "HTTP/") {
+        SPDLOG_ERROR("HTTP session {}, invalid request line", (void *)this);
+        return false;
+    }
+    path = path.substr(0, path.find('?'));
+    // 1.0 closes unless asked to keep alive, 1.1 keeps alive unless asked to close
+    keepAlive_ = version != "HTTP/1.0";
+    for(std::size_t begin = eol + 2; begin < request.size();) {
+        std::size_t end = request.find("\r\n", begin);
+        std::string_view field = request.substr(begin, end - begin);
+        begin = end == std::string_view::npos ? end : end + 2;
+        std::size_t colon = field.find(':');
+        if(colon == std::string_view::npos || !equalsNoCase(trim(field.substr(0, colon)), "connection")) {
+            continue;
+        }
+        std::string_view value = trim(field.substr(colon + 1));
+        if(equalsNoCase(value, "close")) {
+            keepAlive_ = false;
+        } else if(equalsNoCase(value, "keep-alive")) {
+            keepAlive_ = true;
+        }
+    }
+    SPDLOG_INFO("HTTP session {}, {} {}", (void *)this, method, path);
+    if(method != "GET") {
+        sendResponse(405, "Method Not Allowed");
+        return true;
+    }
+    if(!FLAGS_metrics_path.empty() && path == FLAGS_metrics_path) {
+        return sendMetrics();
+    }
+    std::size_t slash = path.rfind('/');
+    if(slash != std::string_view::npos && slash > 1) {
+        std::string app(path.substr(1, slash - 1));
+        std::string_view file = path.substr(slash + 1);
+        constexpr std::string_view flv(".flv");
+        if(file.size() > flv.size() && file.substr(file.size() - flv.size()) == flv) {
+            return playFlv(app, std::string(file.substr(0, file.size() - flv.size())));
+        }
+        if(playHls(app, file)) {
+            return true;
+        }
+    }
+    sendResponse(404, "Not Found");
+    return true;
+}
+
+bool HttpSession::playHls(const std::string &app, std::string_view file)
+{
+    constexpr std::string_view m3u8(".m3u8");
+    constexpr std::string_view ts(".ts");
+    if(file.size() > m3u8.size() && file.substr(file.size() - m3u8.size()) == m3u8) {
+        auto hls = server_.hls(app, std::string(file.substr(0, file.size() - m3u8.size())));
+        FramePtr playlist = hls ? hls->playlist() : nullptr;
+        if(!playlist) {
+            return false;
+        }
+        sendContent("application/vnd.apple.mpegurl", playlist);
+        return true;
+    }
+    // name-N.ts, the name may contain dashes itself
+    std::size_t dash = file.rfind('-');
+    if(file.size() > ts.size() && file.substr(file.size() - ts.size()) == ts && dash != std::string_view::npos && dash > 0) {
+        std::string_view digits = file.substr(dash + 1, file.size() - ts.size() - dash - 1);
+        uint64_t seq;
+        auto [end, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), seq);
+        if(ec != std::errc() || end != digits.data() + digits.size()) {
+            return false;
+        }
+        auto hls = server_.hls(app, std::string(file.substr(0, dash)));
+        FramePtr segment = hls ? hls->segment(seq) : nullptr;
+        if(!segment) {
+            return false;
+        }
+        sendContent("video/mp2t", segment);
+        return true;
+    }
+    return false;
+}
+
+bool HttpSession::sendMetrics()
+{
+    if(FLAGS_metrics_local_only && !fromLoopback()) {
+        sendResponse(403, "Forbidden");
+        return true;
+    }
+    // gathered on every worker, answered back on this one
+    auto self(shared_from_this());
+    server_.metrics([self](std::string text) {
+        auto f = Frame::create(text.size());
+        f->buffer().append(text);
+        boost::asio::post(self->socket_.get_executor(), [self, body = FramePtr(std::move(f))]() {
+            if(!self->stopped_) {
+                self->sendContent("text/plain; version=0.0.4; charset=utf-8", body);
+            }
+        });
+    });
+    return true;
+}
+
+bool HttpSession::fromLoopback()
+{
+    boost::system::error_code ec;
+    auto address = socket_.remote_endpoint(ec).address();
+    if(ec) {
+        return false;
+    }
+    if(address.is_v6() && address.to_v6().is_v4_mapped()) {
+        return boost::asio::ip::make_address_v4(boost::asio::ip::v4_mapped, address.to_v6()).is_loopback();
+    }
+    return address.is_loopback();
+}
+
+void HttpSession::sendContent(std::string_view type, const FramePtr &body)
+{
+    std::string response = "HTTP/1.1 200 OK\r\n"
+                           "Content-Type: " + std::string(type) + "\r\n"
+                           "Content-Length: " + std::to_string(body->readableSize()) + "\r\n"
+                           "Cache-Control: no-cache\r\n"
+                           "Access-Control-Allow-Origin: *\r\n"
+                           + (keepAlive_ ? "Connection: keep-alive\r\n" : "Connection: close\r\n") +
+                           "\r\n";
+    outBuffer_.append(response);
+    // the cached frame itself goes out, no copy
+    sendQueue_.push(outBuffer_);
+    sendQueue_.push(FrameSlice(body));
+    closeAfterWrite_ = !keepAlive_;
+    responding_ = true;
+    doWrite();
+}
+
+bool HttpSession::playFlv(const std::string &app, const std::string &name)
+{
+    static const char response[] =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: video/x-flv\r\n"
+        "Transfer-Encoding: chunked\r\n"
+        "Connection: close\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Access-Control-Allow-Origin: *\r\n"
+        "\r\n";
+    outBuffer_.append(std::string_view(response, sizeof(response) - 1));
+    // FLV header and PreviousTagSize0, as the first chunk
+    outBuffer_.append(std::string_view("d\r\n", 3));
+    outBuffer_.append(flv::HEADER, sizeof(flv::HEADER));
+    outBuffer_.append(std::string_view("\r\n", 2));
+    // queued before the stream bursts its caches
+    stream_ = server_.subscribe(shared_from_this(), app, name);
+    doWrite();
+    doReadClose();
+    return true;
+}
+
+void HttpSession::sendResponse(uint32_t status, std::string_view reason)
+{
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + std::string(reason) + "\r\n"
+                           "Content-Length: 0\r\n"
+                           "Connection: close\r\n"
+                           "\r\n";
+    outBuffer_.append(response);
+    closeAfterWrite_ = true;
+    doWrite();
+}
+
+void HttpSession::doReadClose()
+{
+    // nothing more is expected from the player, only its disconnection
+    auto self(shared_from_this());
+    socket_.async_read_some(boost::asio::buffer(discard_, sizeof(discard_)),
+    [this, self](const boost::system::error_code & ec, std::size_t) {
+        if(!ec) {
+            doReadClose();
+        } else if(ec != boost::asio::error::operation_aborted) {
+            stopSession();
+        }
+    });
+}
+
+void HttpSession::sendPacket(const std::shared_ptr<StreamPacket> &p)
+{
+    switch(sendQueue_.admit(p)) {
+    case SendQueue::Admit::ACCEPT:
+        break;
+    case SendQueue::Admit::DROP:
+        return;
+    case SendQueue::Admit::EVICT: {
+        SPDLOG_WARN("HTTP session {}, over the send queue limit for too long, evicted", (void *)this);
+        Metrics::local().evicted.add();
+        // not from inside the stream's fanout loop
+        auto self(shared_from_this());
+        boost::asio::post(socket_.get_executor(), [self]() {
+            self->stopSession();
+        });
+        return;
+    }
+    }
+    sendQueue_.push(outBuffer_);
+    FrameSlice body = flv::tagBody(*p);
+    if(body.size() != p->payload.size()) {
+        auto q = std::make_shared<StreamPacket>(*p);
+        q->payload = body;
+        sendQueue_.push(q);
+    } else {
+        sendQueue_.push(p);
+    }
+    packetsWritten_++;
+    doWrite();
+}
+
+void HttpSession::collectMetrics(const std::string &labels, SessionMetrics &out)
+{
+    out.queueBytes += sendQueue_.bytes();
+    if(!out.detailed) {
+        return;
+    }
+    char session[64];
+    snprintf(session, sizeof(session), ",protocol=\"http\",session=\"%p\"}", (void *)this);
+    std::string l = labels + session;
+    out.add(SessionMetrics::BYTES_OUT, l, bytesWritten_);
+    out.add(SessionMetrics::MESSAGES_OUT, l, packetsWritten_);
+    out.add(SessionMetrics::QUEUE_BYTES, l, sendQueue_.bytes());
+    out.add(SessionMetrics::DROPPED_VIDEO, l, sendQueue_.droppedVideo());
+    out.add(SessionMetrics::DROPPED_AUDIO, l, sendQueue_.droppedAudio());
+}
+
+void HttpSession::encodeFraming(SendEntry &e)
+{
+    const StreamPacket &p = *e.packet;
+    uint32_t tagSize = flv::TAG_HEADER_SIZE + p.payload.size();
+    // chunk size line, then the tag header
+    int n = snprintf((char *)e.head, sizeof(e.head), "%x\r\n", tagSize + flv::PREVIOUS_TAG_SIZE);
+    e.headSize = n + flv::encodeTagHeader(e.head + n, p.type, p.payload.size(), p.timestamp);
+    // PreviousTagSize and the end of the chunk
+    storeBE<uint32_t, 32>(e.tail, tagSize);
+    memcpy(e.tail + 4, "\r\n", 2);
+    e.tailSize = 6;
+}
+
+uint32_t HttpSession::segments(const SendEntry &e)
+{
+    return e.packet->payload.empty() ? 2 : 3;
+}
+
+boost::asio::const_buffer HttpSession::buffer(const SendEntry &e, uint32_t segment)
+{
+    if(segment == 0) {
+        return boost::asio::const_buffer(e.head, e.headSize);
+    }
+    if(segment + 1 == segments(e)) {
+        return boost::asio::const_buffer(e.tail, e.tailSize);
+    }
+    return boost::asio::const_buffer(e.packet->payload.data(), e.packet->payload.size());
+}
+
+void HttpSession::doWrite()
+{
+    sendQueue_.push(outBuffer_);
+    if(!sendQueue_.gather()) {
+        return;
+    }
+    auto self(shared_from_this());
+    boost::asio::async_write(socket_, sendQueue_.buffers(),
+    [this, self](const boost::system::error_code & ec, std::size_t n) {
+        if(!ec) {
+            bytesWritten_ += n;
+            Metrics::local().httpBytesOut.add(n);
+            sendQueue_.consume();
+            if(closeAfterWrite_ && sendQueue_.empty()) {
+                stopSession();
+                return;
+            }
+            if(responding_ && sendQueue_.empty()) {
+                responding_ = false;
+                request_.erase(0, requestSize_);
+                doReadRequest();
+                return;
+            }
+            doWrite();
+        } else if(ec != boost::asio::error::operation_aborted) {
+            SPDLOG_ERROR("HTTP session {}, fail to write", (void *)this);
+            stopSession();
+        }
+    });
+}
+
+void HttpSession::stopSession()
+{
+    if(stopped_) {
+        return;
+    }
+    stopped_ = true;
+    SPDLOG_INFO("HTTP session {}, stop and free this session", (void *)this);
+    if(sendQueue_.droppedVideo() > 0 || sendQueue_.droppedAudio() > 0) {
+        SPDLOG_INFO("HTTP session {}, dropped {} video and {} audio frames", (void *)this,
+                    sendQueue_.droppedVideo(), sendQueue_.droppedAudio());
+    }
+    if(stream_) {
+        stream_->unsubscribe(shared_from_this());
+        stop();
+    } else {
+        server_.stop(shared_from_this());
+    }
+}
+}
@@ -0,0 +1,256 @@
+#include <memory>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Metrics.hpp"
+#include "Server.hpp"
+#include "Stream.hpp"
+#include "Conf.hpp"
+
+namespace ms777 {
+const double Histogram::BOUNDS[Histogram::BUCKETS] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+static const struct {
+    const char *name;
+    const char *type;
+    const char *help;
+} sessionFamilies[SessionMetrics::FAMILIES] = {
+    { "ms777_session_bytes_in_total", "counter", "bytes read from the session" },
+    { "ms777_session_bytes_out_total", "counter", "bytes written to the session" },
+    { "ms777_session_messages_in_total", "counter", "messages received from the session" },
+    { "ms777_session_messages_out_total", "counter", "stream packets written to the session" },
+    { "ms777_session_queue_bytes", "gauge", "bytes waiting in the send queue of the session" },
+    { "ms777_session_dropped_video_frames_total", "counter", "video frames dropped for the session" },
+    { "ms777_session_dropped_audio_frames_total", "counter", "audio frames dropped for the session" },
+};
+
+static std::unique_ptr<WorkerMetrics[]> workers_;
+static std::size_t workerCount_ = 0;
+
+void Histogram::observe(std::chrono::steady_clock::duration d)
+{
+    double seconds = std::chrono::duration<double>(d).count();
+    // buckets are cumulative, as exported
+    for(std::size_t i = BUCKETS; i > 0 && seconds <= BOUNDS[i - 1]; i--) {
+        buckets_[i - 1].add();
+    }
+    buckets_[BUCKETS].add();
+    sumNanos_.add(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+}
+
+void SessionMetrics::add(Family family, const std::string &labels, uint64_t value)
+{
+    if(detailed) {
+        lines[family] += sessionFamilies[family].name;
+        lines[family] += labels;
+        lines[family] += ' ';
+        lines[family] += std::to_string(value);
+        lines[family] += '\n';
+    }
+}
+
+void Metrics::init(std::size_t workers)
+{
+    workers_.reset(new WorkerMetrics[workers]);
+    workerCount_ = workers;
+}
+
+WorkerMetrics &Metrics::local()
+{
+    return workers_[Server::currentWorker()];
+}
+
+std::string Metrics::labelValue(std::string_view value)
+{
+    std::string s;
+    s.reserve(value.size() + 2);
+    s += '"';
+    for(char c : value) {
+        if(c == '\\' || c == '"') {
+            s += '\\';
+            s += c;
+        } else if(c == '\n') {
+            s += "\\n";
+        } else {
+            s += c;
+        }
+    }
+    s += '"';
+    return s;
+}
+
+static void family(std::string &out, const char *name, const char *type, const char *help)
+{
+    out += "# HELP ";
+    out += name;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += name;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+static void sample(std::string &out, const char *name, const std::string &labels, uint64_t value)
+{
+    out += name;
+    out += labels;
+    out += ' ';
+    out += std::to_string(value);
+    out += '\n';
+}
+
+static void sample(std::string &out, const char *name, const std::string &labels, double value)
+{
+    out += name;
+    out += labels;
+    char number[32];
+    snprintf(number, sizeof(number), " %.9g\n", value);
+    out += number;
+}
+
+static void counter(std::string &out, const char *name, const char *help, Counter WorkerMetrics::*field)
+{
+    uint64_t total = 0;
+    for(std::size_t w = 0; w < workerCount_; w++) {
+        total += (workers_[w].*field).value();
+    }
+    family(out, name, "counter", help);
+    sample(out, name, "", total);
+}
+
+static void histogram(std::string &out, const char *name, const char *help, Histogram WorkerMetrics::*field)
+{
+    family(out, name, "histogram", help);
+    std::string bucket = std::string(name) + "_bucket";
+    double sum = 0;
+    uint64_t count = 0;
+    for(std::size_t i = 0; i <= Histogram::BUCKETS; i++) {
+        uint64_t total = 0;
+        for(std::size_t w = 0; w < workerCount_; w++) {
+            total += (workers_[w].*field).bucket(i);
+        }
+        char le[32];
+        if(i < Histogram::BUCKETS) {
+            snprintf(le, sizeof(le), "{le=\"%g\"}", Histogram::BOUNDS[i]);
+        } else {
+            snprintf(le, sizeof(le), "{le=\"+Inf\"}");
+        }
+        sample(out, bucket.c_str(), le, total);
+    }
+    for(std::size_t w = 0; w < workerCount_; w++) {
+        sum += (workers_[w].*field).sum();
+        count += (workers_[w].*field).count();
+    }
+    sample(out, (std::string(name) + "_sum").c_str(), "", sum);
+    sample(out, (std::string(name) + "_count").c_str(), "", count);
+}
+
+static std::string format(Server &server, const std::vector<SessionMetrics> &parts)
+{
+    std::string out;
+    counter(out, "ms777_rtmp_connections_total", "RTMP connections accepted", &WorkerMetrics::rtmpConnections);
+    counter(out, "ms777_rtmp_bytes_in_total", "bytes read from RTMP connections", &WorkerMetrics::rtmpBytesIn);
+    counter(out, "ms777_rtmp_bytes_out_total", "bytes written to RTMP connections", &WorkerMetrics::rtmpBytesOut);
+    counter(out, "ms777_rtmp_messages_in_total", "RTMP messages received", &WorkerMetrics::rtmpMessagesIn);
+    counter(out, "ms777_rtmp_messages_out_total", "stream packets written to RTMP connections", &WorkerMetrics::rtmpMessagesOut);
+    counter(out, "ms777_rtmp_writes_total", "gathered writes started on RTMP connections", &WorkerMetrics::rtmpWrites);
+    counter(out, "ms777_http_connections_total", "HTTP connections accepted", &WorkerMetrics::httpConnections);
+    counter(out, "ms777_http_bytes_out_total", "bytes written to HTTP connections", &WorkerMetrics::httpBytesOut);
+    counter(out, "ms777_dropped_video_frames_total", "video frames dropped by send queues over their limit", &WorkerMetrics::droppedVideo);
+    counter(out, "ms777_dropped_audio_frames_total", "audio frames dropped by send queues over their limit", &WorkerMetrics::droppedAudio);
+    counter(out, "ms777_evicted_sessions_total", "sessions closed for staying over the send queue limit", &WorkerMetrics::evicted);
+    counter(out, "ms777_rtmp_publishers_moved_total", "publishers moved to the worker running their stream", &WorkerMetrics::publishersMoved);
+    histogram(out, "ms777_rtmp_handshake_seconds", "time from accept or connect to the end of the RTMP handshake", &WorkerMetrics::handshake);
+    histogram(out, "ms777_rtmp_connect_seconds", "time from accept or connect to publishing or playing", &WorkerMetrics::connect);
+    histogram(out, "ms777_stream_fanout_seconds", "time to hand a video message to the subscribers", &WorkerMetrics::fanout);
+
+    uint64_t queueBytes = 0;
+    for(auto &part : parts) {
+        queueBytes += part.queueBytes;
+    }
+    family(out, "ms777_send_queue_bytes", "gauge", "bytes waiting in the send queues");
+    sample(out, "ms777_send_queue_bytes", "", queueBytes);
+
+    // streams
+    auto streams = server.streams();
+    std::vector<std::pair<std::string, Stream::Stats>> stats;
+    stats.reserve(streams.size());
+    std::size_t publishers = 0, subscribers = 0;
+    for(auto &s : streams) {
+        Stream::Stats st = s->stats();
+        publishers += st.published ? 1 : 0;
+        subscribers += st.subscribers;
+        stats.emplace_back("{app=" + Metrics::labelValue(s->app()) + ",name=" + Metrics::labelValue(s->name()) + "}", st);
+    }
+    family(out, "ms777_streams", "gauge", "streams known to the server");
+    sample(out, "ms777_streams", "", streams.size());
+    family(out, "ms777_worker_streams", "gauge", "streams run by the worker");
+    for(std::size_t w = 0; w < server.workers(); w++) {
+        sample(out, "ms777_worker_streams", "{worker=\"" + std::to_string(w) + "\"}", server.workerStreams(w));
+    }
+    family(out, "ms777_streams_reclaimed_total", "counter", "idle streams dropped after --stream_idle_timeout");
+    sample(out, "ms777_streams_reclaimed_total", "", server.streamsReclaimed());
+    family(out, "ms777_publishers", "gauge", "streams with a publisher");
+    sample(out, "ms777_publishers", "", publishers);
+    family(out, "ms777_subscribers", "gauge", "subscribers of all streams");
+    sample(out, "ms777_subscribers", "", subscribers);
+    struct {
+        const char *name;
+        const char *type;
+        const char *help;
+        uint64_t Stream::Stats::*field;
+    } streamFamilies[] = {
+        { "ms777_stream_subscribers", "gauge", "subscribers of the stream", &Stream::Stats::subscribers },
+        { "ms777_stream_bytes_in_total", "counter", "media bytes received by the stream", &Stream::Stats::bytesIn },
+        { "ms777_stream_messages_in_total", "counter", "media messages received by the stream", &Stream::Stats::messagesIn },
+        { "ms777_stream_bytes_out_total", "counter", "media bytes handed to the subscribers", &Stream::Stats::bytesOut },
+        { "ms777_stream_messages_out_total", "counter", "media messages handed to the subscribers", &Stream::Stats::messagesOut },
+    };
+    for(auto &f : streamFamilies) {
+        family(out, f.name, f.type, f.help);
+        for(auto &st : stats) {
+            sample(out, f.name, st.first, st.second.*f.field);
+        }
+    }
+
+    // sessions, if enabled
+    if(!parts.empty() && parts[0].detailed) {
+        for(std::size_t f = 0; f < SessionMetrics::FAMILIES; f++) {
+            family(out, sessionFamilies[f].name, sessionFamilies[f].type, sessionFamilies[f].help);
+            for(auto &part : parts) {
+                out += part.lines[f];
+            }
+        }
+    }
+    return out;
+}
+
+void Metrics::render(Server &server, std::function<void(std::string)> done)
+{
+    struct Collect {
+        std::vector<SessionMetrics> parts; // one per worker, only written by its thread
+        std::atomic<std::size_t> remaining;
+        std::function<void(std::string)> done;
+    };
+    auto c = std::make_shared<Collect>();
+    c->parts.resize(server.workers());
+    c->remaining = server.workers();
+    c->done = std::move(done);
+    for(std::size_t w = 0; w < server.workers(); w++) {
+        boost::asio::post(server.get_io_context(w), [&server, c, w]() {
+            SessionMetrics &part = c->parts[w];
+            part.detailed = FLAGS_metrics_sessions;
+            for(auto &s : server.streams()) {
+                s->collectMetrics(w, part);
+            }
+            if(--c->remaining == 0) {
+                c->done(format(server, c->parts));
+            }
+        });
+    }
+}
+}
@@ -0,0 +1,223 @@
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <spdlog/spdlog.h>
+#if !defined(_WIN32)
+#include <sys/file.h>
+#endif
+#include "Recorder.hpp"
+#include "DiskWriter.hpp"
+#include "Buffer.hpp"
+#include "Flv.hpp"
+#include "Rtmp.hpp"
+#include "Conf.hpp"
+
+namespace ms777 {
+namespace {
+// ms from one timestamp to a later one, negative when timestamps step back
+int64_t elapsed(uint32_t from, uint32_t to)
+{
+    return static_cast<int32_t>(to - from);
+}
+}
+
+struct Recorder::File {
+    std::FILE *fp{ nullptr };
+    std::string path;
+    Buffer data; // one large write per batch
+    std::atomic<std::size_t> pending{ 0 }; // bytes posted but not written yet
+
+    ~File()
+    {
+        close();
+    }
+
+    void open(const std::string &newPath)
+    {
+        close();
+        path = newPath;
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+        fp = std::fopen(path.c_str(), "wb");
+        if(!fp) {
+            SPDLOG_ERROR("Recorder, cannot open {}", path);
+            return;
+        }
+#if !defined(_WIN32)
+        // kept until closed, the VOD player leaves files alone while they grow
+        flock(fileno(fp), LOCK_EX | LOCK_NB);
+#endif
+        SPDLOG_INFO("Recorder, start {}", path);
+        data.append(flv::HEADER, sizeof(flv::HEADER));
+    }
+
+    void write(const std::vector<std::shared_ptr<StreamPacket>> &packets, uint32_t base, std::size_t leadingHeaders)
+    {
+        for(std::size_t i = 0; i < packets.size(); i++) {
+            auto &p = packets[i];
+            FrameSlice body = flv::tagBody(*p);
+            // headers arriving mid-segment keep their place in time
+            int64_t delta = elapsed(base, p->timestamp);
+            uint32_t timestamp = i < leadingHeaders || delta < 0 ? 0 : static_cast<uint32_t>(delta);
+            data.reserve(flv::TAG_HEADER_SIZE + body.size() + flv::PREVIOUS_TAG_SIZE);
+            data.commit(flv::encodeTagHeader(data.writeBuffer(), p->type, body.size(), timestamp));
+            data.append(body.data(), body.size());
+            data.putBE<uint32_t, 32>(flv::TAG_HEADER_SIZE + body.size());
+        }
+        if(fp && data.readableSize() > 0) {
+            if(std::fwrite(data.readBuffer(), 1, data.readableSize(), fp) != data.readableSize()) {
+                SPDLOG_ERROR("Recorder, fail to write {}", path);
+            }
+        }
+        data.clear();
+    }
+
+    void close()
+    {
+        if(fp) {
+            std::fclose(fp);
+            fp = nullptr;
+            SPDLOG_INFO("Recorder, closed {}", path);
+        }
+    }
+};
+
+Recorder::Recorder(DiskWriter &writer, const std::string &app, const std::string &name)
+    : writer_(writer), app_(app), name_(name), file_(std::make_shared<File>())
+{
+    static std::atomic<std::size_t> nextKey{ 0 };
+    key_ = nextKey++;
+    SPDLOG_INFO("Recorder {} created for {}/{}", (void *)this, app, name);
+}
+
+Recorder::~Recorder()
+{
+    SPDLOG_INFO("Recorder {} is closed", (void *)this);
+}
+
+bool Recorder::validName(const std::string &app, const std::string &name)
+{
+    for(auto &part : { app, name }) {
+        if(part.empty() || part.front() == '.' || part.find_first_of("/\\") != std::string::npos
+           || part.find("..") != std::string::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Recorder::sendPacket(const std::shared_ptr<StreamPacket> &p)
+{
+    if(stopped_) {
+        return;
+    }
+    if(p->header) {
+        // kept to start every file with them
+        if(p->type == rtmp::TYPE_DATA) {
+            metaData_ = p;
+        } else if(p->type == rtmp::TYPE_AUDIO) {
+            audioHeader_ = p;
+        } else {
+            videoHeader_ = p;
+        }
+        if(!segmentOpen_) {
+            return;
+        }
+    } else {
+        if(!segmentOpen_ || (splitPoint(*p) && (
+                                 (FLAGS_record_segment_size > 0 && segmentBytes_ >= FLAGS_record_segment_size)
+                                 || (FLAGS_record_segment_duration > 0 && elapsed(base_, p->timestamp) >= FLAGS_record_segment_duration)))) {
+            openSegment(p->timestamp);
+        }
+        // the disk is behind, drop frames and resume video at a key frame
+        bool over = file_->pending + batchBytes_ > FLAGS_record_queue_max_size;
+        if(p->type == rtmp::TYPE_VIDEO) {
+            if(over || (skipVideo_ && !p->keyFrame)) {
+                skipVideo_ = true;
+                dropped_++;
+                return;
+            }
+            skipVideo_ = false;
+        } else if(over) {
+            dropped_++;
+            return;
+        }
+    }
+    if(batch_.empty()) {
+        batchStart_ = p->timestamp;
+    }
+    batch_.push_back(p);
+    batchBytes_ += p->payload.size();
+    segmentBytes_ += p->payload.size();
+    if(batchBytes_ >= FLAGS_record_batch_size || elapsed(batchStart_, p->timestamp) >= FLAGS_record_flush_interval) {
+        flush();
+    }
+}
+
+bool Recorder::splitPoint(const StreamPacket &p)
+{
+    // audio only streams can be split anywhere
+    return videoHeader_ ? (p.type == rtmp::TYPE_VIDEO && p.keyFrame) : p.type == rtmp::TYPE_AUDIO;
+}
+
+void Recorder::openSegment(uint32_t timestamp)
+{
+    flush();
+    char date[32];
+    std::time_t now = std::time(nullptr);
+    std::tm tm;
+#if defined(_WIN32)
+    localtime_s(&tm, &now);
+#else
+    localtime_r(&now, &tm);
+#endif
+    std::strftime(date, sizeof(date), "%Y%m%d-%H%M%S", &tm);
+    openPath_ = FLAGS_record_path + "/" + app_ + "/" + name_ + "-" + date + "-" + std::to_string(segments_++) + ".flv";
+    base_ = timestamp;
+    batchStart_ = timestamp;
+    segmentOpen_ = true;
+    segmentBytes_ = 0;
+    for(auto &h : { metaData_, audioHeader_, videoHeader_ }) {
+        if(h) {
+            batch_.push_back(h);
+            batchBytes_ += h->payload.size();
+        }
+    }
+    leadingHeaders_ = batch_.size();
+}
+
+void Recorder::flush(bool close)
+{
+    if(batch_.empty() && openPath_.empty() && !close) {
+        return;
+    }
+    file_->pending += batchBytes_;
+    writer_.post(key_, [file = file_, path = std::move(openPath_), packets = std::move(batch_),
+                    bytes = batchBytes_, base = base_, leading = leadingHeaders_, close]() {
+        if(!path.empty()) {
+            file->open(path);
+        }
+        file->write(packets, base, leading);
+        if(close) {
+            file->close();
+        }
+        file->pending -= bytes;
+    });
+    openPath_.clear();
+    batch_.clear();
+    batchBytes_ = 0;
+    leadingHeaders_ = 0;
+}
+
+void Recorder::stop()
+{
+    if(stopped_) {
+        return;
+    }
+    stopped_ = true;
+    if(dropped_ > 0) {
+        SPDLOG_WARN("Recorder {}, dropped {} frames, the disk was too slow", (void *)this, dropped_);
+    }
+    flush(true);
+}
+}
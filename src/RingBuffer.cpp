@@ -0,0 +1,151 @@
+#include <cassert>
+#include <cstring>
+#include <spdlog/spdlog.h>
+#include "RingBuffer.hpp"
+
+#if defined(__linux__)
+#include <atomic>
+#include <fstream>
+#include <sys/mman.h>
+#include <unistd.h>
+#define MS777_HAS_MIRRORED_RING 1
+#endif
+
+namespace ms777 {
+#if defined(MS777_HAS_MIRRORED_RING)
+namespace {
+std::atomic<std::size_t> mirroredRings{ 0 };
+std::atomic<bool> fallbackLogged{ false };
+
+// a mirrored ring holds two of the process' vm.max_map_count mappings,
+// rings get at most half of them so mmap keeps working for the rest
+std::size_t mirroredRingLimit()
+{
+    static const std::size_t limit = []() {
+        std::ifstream in("/proc/sys/vm/max_map_count");
+        std::size_t maps;
+        return (in >> maps) ? maps / 4 : 65530 / 4;
+    }();
+    return limit;
+}
+}
+#endif
+
+RingBuffer::RingBuffer(uint32_t capacity)
+{
+#if defined(MS777_HAS_MIRRORED_RING)
+    // both halves map the same pages, the size must be page aligned
+    uint32_t page = sysconf(_SC_PAGESIZE);
+    capacity_ = (capacity + page - 1) / page * page;
+    int fd = -1;
+    if(mirroredRings.fetch_add(1) < mirroredRingLimit()) {
+        fd = memfd_create("ms777-ring", MFD_CLOEXEC);
+    }
+    if(fd >= 0) {
+        void *addr = MAP_FAILED;
+        if(0 == ftruncate(fd, capacity_)) {
+            addr = mmap(nullptr, 2 * capacity_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        if(addr != MAP_FAILED) {
+            uint8_t *p = (uint8_t *)addr;
+            if(mmap(p, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED
+               && mmap(p + capacity_, capacity_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED) {
+                start_ = p;
+                mirrored_ = true;
+            } else {
+                munmap(addr, 2 * capacity_);
+            }
+        }
+        close(fd);
+    }
+    if(!mirrored_) {
+        mirroredRings--;
+        // once, it would repeat for every session past the limit
+        if(!fallbackLogged.exchange(true)) {
+            SPDLOG_WARN("RingBuffer, cannot map a mirrored region with {} mapped, fall back to linear buffers",
+                        mirroredRings.load());
+        }
+    }
+#endif
+    if(!mirrored_) {
+        capacity_ = capacity;
+        start_ = new uint8_t[capacity_];
+    }
+}
+
+RingBuffer::~RingBuffer()
+{
+#if defined(MS777_HAS_MIRRORED_RING)
+    if(mirrored_) {
+        munmap(start_, 2 * capacity_);
+        mirroredRings--;
+        return;
+    }
+#endif
+    delete []start_;
+}
+
+void RingBuffer::clear()
+{
+    readPos_ = size_ = 0;
+}
+
+const uint8_t *RingBuffer::readBuffer() const
+{
+    return start_ + readPos_;
+}
+
+uint32_t RingBuffer::readableSize() const
+{
+    return size_;
+}
+
+std::string_view RingBuffer::stringView() const
+{
+    return std::string_view((const char *)readBuffer(), readableSize());
+}
+
+void RingBuffer::erase(uint32_t n)
+{
+    assert(size_ >= n);
+    size_ -= n;
+    if(mirrored_) {
+        readPos_ = (readPos_ + n) % capacity_;
+    } else if(0 == size_) {
+        readPos_ = 0;
+    } else {
+        readPos_ += n;
+        if(readPos_ > capacity_ / 2) {
+            memmove(start_, start_ + readPos_, size_);
+            readPos_ = 0;
+        }
+    }
+}
+
+uint8_t *RingBuffer::writeBuffer()
+{
+    if(mirrored_) {
+        return start_ + (readPos_ + size_) % capacity_;
+    }
+    return start_ + readPos_ + size_;
+}
+
+uint32_t RingBuffer::writableSize() const
+{
+    if(mirrored_) {
+        return capacity_ - size_;
+    }
+    return capacity_ - readPos_ - size_;
+}
+
+void RingBuffer::commit(uint32_t n)
+{
+    assert(writableSize() >= n);
+    size_ += n;
+}
+
+uint32_t RingBuffer::capacity() const
+{
+    return capacity_;
+}
+}
@@ -309,25 +309,83 @@ void AmfEncoder::put(std::string_view v)
     data_.commit(v.size());
 }
 
-MessageEncoder::MessageEncoder(Buffer &output)
-    : output_(output)
+MessageEncoder::MessageEncoder(Buffer &output, uint32_t chunkSize)
+    : output_(output), chunkSize_(chunkSize)
 {
 }
 
-void MessageEncoder::encodeChunkHeader0(uint8_t type, uint32_t length, uint8_t cid, uint32_t sid, uint32_t timestamp)
+static uint32_t encodeChunkHeader(uint8_t *output, uint8_t fmt, uint8_t type, uint32_t length, uint8_t cid, uint32_t sid, uint32_t field)
 {
     assert(cid < 64);
-    output_.putBE<uint8_t, 8>(cid); // (CHUNK_TYPE_0(0) << 6) | cid
-    output_.putBE<uint32_t, 24>(timestamp); // timestamp
-    output_.putBE<uint32_t, 24>(length); // length
-    output_.putBE<uint8_t, 8>(type); // type
-    output_.putLE<uint32_t, 32>(sid); // sid = 0
+    uint8_t *p = output;
+    storeBE<uint8_t, 8>(p, (fmt << 6) | cid);
+    p += 1;
+    if(fmt <= CHUNK_TYPE_2) {
+        storeBE<uint32_t, 24>(p, std::min(field, EXTENDED_TIMESTAMP)); // timestamp or delta
+        p += 3;
+    }
+    if(fmt <= CHUNK_TYPE_1) {
+        storeBE<uint32_t, 24>(p, length); // length
+        storeBE<uint8_t, 8>(p + 3, type); // type
+        p += 4;
+    }
+    if(fmt == CHUNK_TYPE_0) {
+        storeLE<uint32_t, 32>(p, sid); // sid
+        p += 4;
+    }
+    if(field >= EXTENDED_TIMESTAMP) {
+        storeBE<uint32_t, 32>(p, field); // extended timestamp, also repeated by fmt 3 chunks
+        p += 4;
+    }
+    return p - output;
 }
 
-void MessageEncoder::encodeChunkHeader3(uint8_t cid)
+uint32_t encodeChunkHeader0(uint8_t *output, uint8_t type, uint32_t length, uint8_t cid, uint32_t sid, uint32_t timestamp)
 {
-    assert(cid < 64);
-    output_.putBE<uint8_t, 8>((3 << 6) | cid);
+    return encodeChunkHeader(output, CHUNK_TYPE_0, type, length, cid, sid, timestamp);
+}
+
+uint32_t encodeChunkHeader3(uint8_t *output, uint8_t cid, uint32_t field)
+{
+    return encodeChunkHeader(output, CHUNK_TYPE_3, 0, 0, cid, 0, field);
+}
+
+uint32_t encodeChunkHeader(uint8_t *output, ChunkStreamState &state, uint8_t type, uint32_t length, uint8_t cid, uint32_t sid, uint32_t timestamp)
+{
+    // fmt 0 for a new chunk stream, another stream id or a timestamp going backwards
+    uint8_t fmt = CHUNK_TYPE_0;
+    uint32_t field = timestamp;
+    if(state.valid && state.sid == sid && timestamp >= state.timestamp) {
+        field = timestamp - state.timestamp;
+        if(state.type != type || state.length != length) {
+            fmt = CHUNK_TYPE_1;
+        } else if(!state.hasDelta || state.field != field) {
+            // the delta implied by fmt 3 after fmt 0 is ambiguous among peers, so only after fmt 1/2
+            fmt = CHUNK_TYPE_2;
+        } else {
+            fmt = CHUNK_TYPE_3;
+        }
+    }
+    state.valid = true;
+    state.hasDelta = (fmt != CHUNK_TYPE_0);
+    state.type = type;
+    state.sid = sid;
+    state.length = length;
+    state.timestamp = timestamp;
+    state.field = field;
+    return encodeChunkHeader(output, fmt, type, length, cid, sid, field);
+}
+
+void MessageEncoder::encodeChunkHeader0(uint8_t type, uint32_t length, uint8_t cid, uint32_t sid, uint32_t timestamp)
+{
+    output_.reserve(MAX_CHUNK_HEADER_SIZE);
+    output_.commit(rtmp::encodeChunkHeader0(output_.writeBuffer(), type, length, cid, sid, timestamp));
+}
+
+void MessageEncoder::encodeChunkHeader3(uint8_t cid, uint32_t field)
+{
+    output_.reserve(5);
+    output_.commit(rtmp::encodeChunkHeader3(output_.writeBuffer(), cid, field));
 }
 
 void MessageEncoder::encodeWindowAck(uint32_t size)
@@ -353,6 +411,7 @@ void MessageEncoder::encodeSetChunkSize(uint32_t size)
 {
     encodeChunkHeader0(TYPE_SET_CHUNK_SIZE, 4, CID_PROTOCOL_CONTROL, 0, 0);
     output_.putBE<uint32_t, 32>(size); // body
+    chunkSize_ = size; // following messages are chunked with the new size
 }
 
 void MessageEncoder::encodePingResponse(uint32_t timestamp)
@@ -423,6 +482,22 @@ void MessageEncoder::encodeOnStatusPlay(uint32_t sid)
     encodeMessage(messageBody_, TYPE_INVOKE, CID_OVER_STREAM, sid, 0);
 }
 
+void MessageEncoder::encodeOnStatus(uint32_t sid, std::string_view level, std::string_view code,
+                                    std::string_view description)
+{
+    messageBody_.clear();
+    AmfEncoder enc(messageBody_);
+    enc.putString(std::string_view("onStatus", 8));
+    enc.putNumber(0);
+    enc.putNull();
+    enc.putObjectBegin();
+    enc.putObjectValue(std::string_view("level", 5), level);
+    enc.putObjectValue(std::string_view("code", 4), code);
+    enc.putObjectValue(std::string_view("description", 11), description);
+    enc.putObjectEnd();
+    encodeMessage(messageBody_, TYPE_INVOKE, CID_OVER_STREAM, sid, 0);
+}
+
 void MessageEncoder::encodeCreateStreamResult(double tid)
 {
     messageBody_.clear();
@@ -531,12 +606,12 @@ void MessageEncoder::encodeMessage(Buffer &payload, uint8_t type, uint8_t cid, u
 void MessageEncoder::encodeMessage(std::string_view payload, uint8_t type, uint8_t cid, uint32_t sid, uint32_t timestamp)
 {
     encodeChunkHeader0(type, payload.size(), cid, sid, timestamp);
-    uint32_t chunk_size = std::min(FLAGS_rtmp_chunk_size, (uint32_t)payload.size());
+    uint32_t chunk_size = std::min(chunkSize_, (uint32_t)payload.size());
     output_.append((const uint8_t *)payload.data(), chunk_size);
     uint32_t offset = chunk_size, len = payload.size() - chunk_size;
     while(len > 0) {
-        encodeChunkHeader3(cid);
-        chunk_size = std::min(len, FLAGS_rtmp_chunk_size);
+        encodeChunkHeader3(cid, timestamp);
+        chunk_size = std::min(len, chunkSize_);
         output_.append((const uint8_t *)payload.data() + offset, chunk_size);
         len -= chunk_size;
         offset += chunk_size;
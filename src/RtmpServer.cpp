@@ -1,10 +1,21 @@
 #include <spdlog/spdlog.h>
 #include "RtmpServer.hpp"
 #include "Server.hpp"
+#include "Metrics.hpp"
 #include "Conf.hpp"
 
+#if (defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)) && !defined(__CYGWIN__)
+#define MS777_HAS_REUSE_PORT 1
+#endif
+
 namespace ms777 {
-RtmpServer::RtmpServer(Server &server) : server_(server), acceptor_(server.get_io_context())
+// 100 ms ticks, a turn of the wheel covers 51.2 s
+constexpr uint32_t TIMER_WHEEL_TICK = 100;
+constexpr uint32_t TIMER_WHEEL_SLOTS = 512;
+
+RtmpServer::RtmpServer(Server &server, std::size_t index)
+    : server_(server), index_(index), acceptor_(server.get_io_context(index)),
+      timerWheel_(server.get_io_context(index), TIMER_WHEEL_TICK, TIMER_WHEEL_SLOTS)
 {
 }
 
@@ -14,39 +25,53 @@ RtmpServer::~RtmpServer()
 
 void RtmpServer::start()
 {
-    boost::asio::ip::tcp::resolver resolver(server_.get_io_context());
+    timerWheel_.start();
+#if !defined(MS777_HAS_REUSE_PORT)
+    // without SO_REUSEPORT the first worker accepts and hands sockets to the others
+    if(index_ > 0) {
+        return;
+    }
+#endif
+    boost::asio::ip::tcp::resolver resolver(server_.get_io_context(index_));
     boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(FLAGS_rtmp_server_ip,
             std::to_string(FLAGS_rtmp_server_port)).begin();
     acceptor_.open(endpoint.protocol());
     acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-#if (defined(unix) || defined(__unix) || defined(__unix__) || defined(__APPLE__)) && !defined(__CYGWIN__)
+#if defined(MS777_HAS_REUSE_PORT)
     typedef boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
     acceptor_.set_option(reuse_port(true));
 #endif
     acceptor_.bind(endpoint);
     acceptor_.listen();
-    SPDLOG_INFO("RTMP server listening ({}:{})", FLAGS_rtmp_server_ip, FLAGS_rtmp_server_port);
+    SPDLOG_INFO("RTMP server {} listening ({}:{})", index_, FLAGS_rtmp_server_ip, FLAGS_rtmp_server_port);
     doAccept();
 }
 
 void RtmpServer::stop()
 {
-    SPDLOG_INFO("Stop RTMP server, close all clients");
+    SPDLOG_INFO("Stop RTMP server {}, close all clients", index_);
+    stopped_ = true;
     acceptor_.close();
+    for(auto &t : timers_) {
+        t->cancel();
+    }
+    timers_.clear();
+    timerWheel_.stop();
+    deferred_.clear();
     std::shared_ptr<RtmpSession> c = sessions_.front();
     while(c) {
         c->stop();
         c = SpIntrusiveList<RtmpSession>::next(c);
     }
     sessions_.clear();
-    for(auto &s : streams_) {
-        s.second->stop();
+    for(auto &s : server_.streams()) {
+        s->stop(index_);
     }
-    streams_.clear();
 }
 
 void RtmpServer::doAccept()
 {
+#if defined(MS777_HAS_REUSE_PORT)
     acceptor_.async_accept(
     [this](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
         if(!acceptor_.is_open()) {
@@ -54,12 +79,37 @@ void RtmpServer::doAccept()
             return;
         }
         if(!ec) {
-            auto c = std::make_shared<RtmpSession>(*this, std::move(socket));
-            sessions_.addFront(c);
-            c->start();
+            startSession(std::move(socket));
+        }
+        doAccept();
+    });
+#else
+    static std::size_t nextWorker = 0;
+    std::size_t worker = nextWorker++ % server_.workers();
+    acceptor_.async_accept(server_.get_io_context(worker),
+    [this, worker](boost::system::error_code ec, boost::asio::ip::tcp::socket socket) {
+        if(!acceptor_.is_open()) {
+            SPDLOG_DEBUG("RTMP server is closed, ignore new clients");
+            return;
+        }
+        if(!ec) {
+            RtmpServer *target = &server_.rtmpServer(worker);
+            boost::asio::post(server_.get_io_context(worker),
+            [target, s = std::make_shared<boost::asio::ip::tcp::socket>(std::move(socket))]() {
+                target->startSession(std::move(*s));
+            });
         }
         doAccept();
     });
+#endif
+}
+
+void RtmpServer::startSession(boost::asio::ip::tcp::socket socket)
+{
+    auto c = std::make_shared<RtmpSession>(*this, std::move(socket));
+    Metrics::local().rtmpConnections.add();
+    sessions_.addFront(c);
+    c->start();
 }
 
 void RtmpServer::stop(std::shared_ptr<RtmpSession> c)
@@ -69,34 +119,163 @@ void RtmpServer::stop(std::shared_ptr<RtmpSession> c)
     c->stop();
 }
 
-std::shared_ptr<Stream> RtmpServer::getStream(std::string &app, std::string &name)
-{
-    auto key = app + "/" + name;
-    auto i = streams_.find(key);
-    if(i != streams_.end()) {
-        return i->second;
-    }
-    auto stream = std::make_shared<Stream>(app, name);
-    streams_[key] = stream;
-    return stream;
-}
-
 bool RtmpServer::publish(std::shared_ptr<RtmpSession> c)
 {
-    sessions_.erase(c);
-    auto s = getStream(c->app(), c->name());
+    auto s = server_.getStream(StreamKey(c->app(), c->name()));
     if(s->publish(c)) {
+        sessions_.erase(c);
         c->setStream(s);
         return true;
     }
     return false;
 }
 
+RtmpServer *RtmpServer::streamServer(const std::string &app, const std::string &name)
+{
+    auto s = server_.getStream(StreamKey(app, name));
+    return &server_.rtmpServer(s->worker());
+}
+
+void RtmpServer::release(std::shared_ptr<RtmpSession> c)
+{
+    sessions_.erase(c);
+}
+
+void RtmpServer::adopt(std::shared_ptr<RtmpSession> c, boost::asio::ip::tcp protocol,
+                       boost::asio::ip::tcp::socket::native_handle_type fd)
+{
+    boost::asio::post(server_.get_io_context(index_), [this, c, protocol, fd]() {
+        // the socket closes with it if this worker stopped meanwhile
+        boost::asio::ip::tcp::socket socket(server_.get_io_context(index_));
+        boost::system::error_code ec;
+        socket.assign(protocol, fd, ec);
+        if(ec || stopped_) {
+            c->stop();
+            return;
+        }
+        sessions_.addFront(c);
+        c->onMoved(std::move(socket));
+    });
+}
+
 void RtmpServer::subscribe(std::shared_ptr<RtmpSession> c)
 {
     sessions_.erase(c);
-    auto s = getStream(c->app(), c->name());
+    auto s = server_.getStream(StreamKey(c->app(), c->name()));
     s->subscribe(c);
     c->setStream(s);
+    pull(s);
+}
+
+void RtmpServer::pull(std::shared_ptr<Stream> s)
+{
+    if(FLAGS_edge_origin.empty() || stopped_ || s->pullPending() || s->published()) {
+        return;
+    }
+    if(s->worker() != index_) {
+        RtmpServer *owner = &server_.rtmpServer(s->worker());
+        boost::asio::post(server_.get_io_context(owner->index_), [owner, s]() {
+            owner->pull(s);
+        });
+        return;
+    }
+    std::string host, port;
+    splitAddress(FLAGS_edge_origin, host, port);
+    // the upstream session takes the publisher's place, later viewers share it
+    auto c = std::make_shared<RtmpSession>(*this, boost::asio::ip::tcp::socket(server_.get_io_context(index_)),
+                                           RtmpSession::Direction::INPUT, s->app(), s->name());
+    if(!s->publish(c)) {
+        return;
+    }
+    SPDLOG_INFO("RTMP server {}, pull {}/{} from {}", index_, s->app(), s->name(), FLAGS_edge_origin);
+    c->setStream(s);
+    c->connect(host, port);
+}
+
+void RtmpServer::retryPull(std::shared_ptr<Stream> s)
+{
+    if(FLAGS_edge_origin.empty()) {
+        return;
+    }
+    runAfter(FLAGS_edge_retry_interval, [this, s]() {
+        s->setPullPending(false);
+        if(s->viewers() > 0) {
+            pull(s);
+        }
+    });
+}
+
+std::shared_ptr<RtmpSession> RtmpServer::push(std::shared_ptr<Stream> s, const std::string &target)
+{
+    if(stopped_) {
+        return nullptr;
+    }
+    std::string host, port;
+    splitAddress(target, host, port);
+    auto c = std::make_shared<RtmpSession>(*this, boost::asio::ip::tcp::socket(server_.get_io_context(index_)),
+                                           RtmpSession::Direction::OUTPUT, s->app(), s->name());
+    SPDLOG_INFO("RTMP server {}, forward {}/{} to {}", index_, s->app(), s->name(), target);
+    c->setStream(s);
+    c->connect(host, port);
+    return c;
+}
+
+void RtmpServer::runAfter(uint32_t ms, std::function<void()> task)
+{
+    if(stopped_) {
+        return;
+    }
+    auto timer = std::make_shared<boost::asio::steady_timer>(server_.get_io_context(index_), std::chrono::milliseconds(ms));
+    timers_.insert(timer);
+    timer->async_wait([this, timer, task = std::move(task)](const boost::system::error_code & ec) {
+        if(ec) {
+            return;
+        }
+        timers_.erase(timer);
+        task();
+    });
+}
+
+void RtmpServer::deferWrite(std::shared_ptr<RtmpSession> c)
+{
+    deferred_.push_back(std::move(c));
+    if(!flushPosted_) {
+        // for packets fanned out by other workers, a demux loop flushes its own earlier
+        flushPosted_ = true;
+        boost::asio::post(server_.get_io_context(index_), [this]() {
+            flushPosted_ = false;
+            flushWrites();
+        });
+    }
+}
+
+void RtmpServer::flushWrites()
+{
+    flushing_.swap(deferred_);
+    for(auto &c : flushing_) {
+        c->flush();
+    }
+    flushing_.clear();
+}
+
+std::shared_ptr<VodFile> RtmpServer::vodFile(const std::string &name)
+{
+    return server_.vodFile(name);
+}
+
+void RtmpServer::splitAddress(const std::string &address, std::string &host, std::string &port)
+{
+    // host, host:port, [v6] or [v6]:port
+    host = address;
+    port = "1935";
+    std::size_t colon = host.rfind(':');
+    if(colon != std::string::npos && host.find(']', colon) == std::string::npos
+       && (host.front() == '[' || host.find(':') == colon)) {
+        port = host.substr(colon + 1);
+        host.resize(colon);
+    }
+    if(host.size() > 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
 }
 }
@@ -1,9 +1,12 @@
+#include <algorithm>
 #include <cassert>
 #include <chrono>
+#include <limits>
 #include <spdlog/spdlog.h>
 #include <spdlog/fmt/bin_to_hex.h>
 #include "RtmpServer.hpp"
 #include "RtmpSession.hpp"
+#include "Metrics.hpp"
 #include "Rtmp.hpp"
 #include "Conf.hpp"
 
@@ -14,29 +17,74 @@ static inline uint64_t timeNow()
            (std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
+
 RtmpSession::RtmpSession(RtmpServer &server, boost::asio::ip::tcp::socket socket)
-    : server_(server),
+    : server_(&server),
       socket_(std::move(socket)),
       type_(Type::HOST),
       dir_(Direction::NONE),
-      inBuffer_(FLAGS_rtmp_read_buffer_size),
+      inBuffer_(std::max<uint32_t>(FLAGS_rtmp_read_buffer_size, 1 + rtmp::HANDSHAKE_SIZE)),
       outBuffer_(1024),
-      outBufferFlush_(1024)
+      sendQueue_(*this)
+{
+}
+
+RtmpSession::RtmpSession(RtmpServer &server, boost::asio::ip::tcp::socket socket, Direction dir,
+                         const std::string &app, const std::string &name)
+    : RtmpSession(server, std::move(socket))
 {
+    type_ = Type::CLIENT;
+    dir_ = dir;
+    app_ = app;
+    name_ = name;
 }
 
 void RtmpSession::start()
 {
     SPDLOG_INFO("RTMP session {}, wait handshake", (void *)this);
+    startTime_ = std::chrono::steady_clock::now();
+    watchTimeouts();
     doReadC0C1();
 }
 
 void RtmpSession::stop()
 {
     SPDLOG_INFO("RTMP session {}, close socket", (void *)this);
+    closed_ = true;
     socket_.close();
 }
 
+void RtmpSession::connect(const std::string &host, const std::string &port)
+{
+    SPDLOG_INFO("RTMP session {}, connect to {}:{} for {}/{}", (void *)this, host, port, app_, name_);
+    tcUrl_ = "rtmp://" + host + ":" + port + "/" + app_;
+    startTime_ = std::chrono::steady_clock::now();
+    watchTimeouts();
+    auto self(shared_from_this());
+    auto resolver = std::make_shared<boost::asio::ip::tcp::resolver>(socket_.get_executor());
+    resolver->async_resolve(host, port,
+    [this, self, resolver](const boost::system::error_code & ec, boost::asio::ip::tcp::resolver::results_type results) {
+        if(closed_) {
+            // stopped while resolving, do not reopen the socket
+            return;
+        }
+        if(ec) {
+            SPDLOG_ERROR("RTMP session {}, fail to resolve {}", (void *)this, tcUrl_);
+            stopSession();
+            return;
+        }
+        boost::asio::async_connect(socket_, results,
+        [this, self](const boost::system::error_code & ec, const boost::asio::ip::tcp::endpoint &) {
+            if(!ec) {
+                doWriteC0C1();
+            } else if(ec != boost::asio::error::operation_aborted) {
+                SPDLOG_ERROR("RTMP session {}, fail to connect {}", (void *)this, tcUrl_);
+                stopSession();
+            }
+        });
+    });
+}
+
 void RtmpSession::setStream(std::shared_ptr<Stream> stream)
 {
     stream_ = stream;
@@ -45,7 +93,6 @@ void RtmpSession::setStream(std::shared_ptr<Stream> stream)
 void RtmpSession::doReadC0C1()
 {
     auto self(shared_from_this());
-    inBuffer_.reserve(1 + rtmp::HANDSHAKE_SIZE);
     boost::asio::async_read(socket_, boost::asio::buffer(inBuffer_.writeBuffer(), 1 + rtmp::HANDSHAKE_SIZE),
     [this, self](const boost::system::error_code & ec, std::size_t len) {
         if(!ec) {
@@ -81,6 +128,7 @@ bool RtmpSession::parseC0C1GenerateS0S1S2()
     outBuffer_.commit(1 + rtmp::HANDSHAKE_SIZE);
     // echo c1
     outBuffer_.append(inBuffer_.readBuffer() + 1, rtmp::HANDSHAKE_SIZE);
+    inBuffer_.clear();
     auto self(shared_from_this());
     boost::asio::async_write(socket_, boost::asio::buffer(outBuffer_.readBuffer(), outBuffer_.readableSize()),
     [this, self](const boost::system::error_code & ec, std::size_t) {
@@ -97,6 +145,7 @@ bool RtmpSession::parseC0C1GenerateS0S1S2()
 
 void RtmpSession::doWriteC0C1()
 {
+    outBuffer_.reserve(1 + rtmp::HANDSHAKE_SIZE);
     *outBuffer_.writeBuffer() = rtmp::HANDSHAKE_VERSION;
     storeBE<uint32_t, 32>(outBuffer_.writeBuffer() + 1, static_cast<uint32_t>(timeNow() / 1000));
     storeBE<uint32_t, 32>(outBuffer_.writeBuffer() + 5, 0);
@@ -116,10 +165,10 @@ void RtmpSession::doWriteC0C1()
 void RtmpSession::doReadS0S1()
 {
     auto self(shared_from_this());
-    inBuffer_.reserve(1 + rtmp::HANDSHAKE_SIZE);
     boost::asio::async_read(socket_, boost::asio::buffer(inBuffer_.writeBuffer(), 1 + rtmp::HANDSHAKE_SIZE),
     [this, self](const boost::system::error_code & ec, std::size_t len) {
         if(!ec) {
+            inBuffer_.commit(1 + rtmp::HANDSHAKE_SIZE);
             if(!parseS0S1GenerateC2()) {
                 stopSession();
             }
@@ -160,6 +209,14 @@ void RtmpSession::doReadC2S2()
             //TODO:XXX
             inBuffer_.clear();
             SPDLOG_INFO("RTMP session {}, handshake done", (void *)this);
+            Metrics::local().handshake.observe(std::chrono::steady_clock::now() - startTime_);
+            if(type_ == Type::CLIENT) {
+                rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
+                enc.encodeSetChunkSize(FLAGS_rtmp_chunk_size);
+                outChunkSize_ = FLAGS_rtmp_chunk_size;
+                enc.encodeConnect(app_.c_str(), "", tcUrl_.c_str(), rtmp::TRANSACTION_ID_CLIENT_CONNECT);
+                doWrite();
+            }
             doReadChunk();
         }  else if(ec != boost::asio::error::operation_aborted) {
             SPDLOG_ERROR("RTMP session {}, fail to read handshake c2/s2", (void *)this);
@@ -170,220 +227,227 @@ void RtmpSession::doReadC2S2()
 
 void RtmpSession::stopSession()
 {
+    if(stopped_) {
+        return;
+    }
+    stopped_ = true;
     SPDLOG_INFO("RTMP session {}, stop and free this session", (void *)this);
-    if(dir_ != Direction::NONE) {
+    if(sendQueue_.droppedVideo() > 0 || sendQueue_.droppedAudio() > 0) {
+        SPDLOG_INFO("RTMP session {}, dropped {} video and {} audio frames", (void *)this,
+                    sendQueue_.droppedVideo(), sendQueue_.droppedAudio());
+    }
+    if(vod_) {
+        // never joined a stream
+        server_->stop(shared_from_this());
+    } else if(dir_ != Direction::NONE) {
         assert(stream_);
         stream_->stop(shared_from_this());
     } else {
-        server_.stop(shared_from_this());
+        server_->stop(shared_from_this());
     }
 }
 
 void RtmpSession::doReadChunk()
 {
+    // a large chunk body still pending is read straight into the message payload
+    if(FLAGS_rtmp_direct_read_size > 0) {
+        uint32_t size = demuxer_.pendingPayload();
+        if(size > 0 && size >= FLAGS_rtmp_direct_read_size) {
+            doReadChunkPayload(size);
+            return;
+        }
+    }
     auto self(shared_from_this());
     socket_.async_read_some(boost::asio::buffer(inBuffer_.writeBuffer(), inBuffer_.writableSize()),
     [this, self](boost::system::error_code ec, std::size_t bytes_transferred) {
         if(!ec) {
             inBuffer_.commit(bytes_transferred);
-            while(inBuffer_.readableSize() > 0) {
-                if(readingChunkHeader_) {
-                    if(!decodeChunkHeader()) {
-                        break;
-                    }
-                } else {
-                    if(!decodeChunkPayload()) {
-                        break;
-                    }
-                }
-            }
-            doReadChunk();
+            onBytesRead(bytes_transferred);
+            onChunks();
         } else if(ec != boost::asio::error::operation_aborted) {
             stopSession();
         }
     });
 }
 
-bool RtmpSession::decodeChunkHeader()
+void RtmpSession::onChunks()
 {
-    const uint8_t *data = inBuffer_.readBuffer();
-    uint32_t offset = 0, readableSize = inBuffer_.readableSize();
-    // chunk flags
-    if(readableSize < 1) {
-        return false;
-    }
-    uint8_t flags = *(data + offset);
-    chunkHeaderFmt_ = flags >> 6;
-    chunkHeaderCid_ = flags & 0x3f;
-    offset += 1;
-    readableSize -= 1;
-    // possible cid >= 64
-    if(chunkHeaderCid_ == 0) {
-        if(readableSize < 1) {
-            return false;
-        }
-        chunkHeaderCid_ = 64 + (uint16_t) * (data + offset);
-        offset += 1;
-        readableSize -= 1;
-    } else if(chunkHeaderCid_ == 1) {
-        if(readableSize < 2) {
-            return false;
+    while(inBuffer_.readableSize() > 0) {
+        uint32_t consumed = 0;
+        auto result = demuxer_.decode(inBuffer_.readBuffer(), inBuffer_.readableSize(), consumed);
+        inBuffer_.erase(consumed);
+        // what follows a publish moving away is decoded on the new worker
+        if(result == ChunkDemuxer::Result::NEED_MORE || !onChunkResult(result) || moveTo_) {
+            break;
         }
-        uint16_t cid;
-        loadLE<uint16_t, 16>(data + offset, cid);
-        chunkHeaderCid_ = 64 + cid;
-        offset += 2;
-        readableSize -= 2;
     }
-    // chunk header: 11/7/3/0 bytes
-    if(readableSize < rtmp::ChunkHeaderSize[chunkHeaderFmt_]) {
-        return false;
+    // subscribers on this worker write everything the read brought in one go
+    server_->flushWrites();
+    if(moveTo_) {
+        moveWhenIdle();
+        return;
     }
-    // new or previous message slot
-    auto m = getMessage(chunkHeaderCid_);
-    if(!m) {
-        SPDLOG_ERROR("RTMP session {}, cannot get message slot for cid={}", (void *)this, chunkHeaderCid_);
-        stopSession();
-        return false;
-    }
-    if(chunkHeaderFmt_ <= rtmp::CHUNK_TYPE_2) {
-        loadBE<uint32_t, 24>(data + offset, m->h.timestamp);
-        offset += 3;
-        readableSize -= 3;
-    }
-    if(chunkHeaderFmt_ <= rtmp::CHUNK_TYPE_1) {
-        loadBE<uint32_t, 24>(data + offset, m->h.length);
-        offset += 3;
-        readableSize -= 3;
-        loadBE<uint8_t, 8>(data + offset, m->h.type);
-        offset += 1;
-        readableSize -= 1;
-    }
-    if(chunkHeaderFmt_ == rtmp::CHUNK_TYPE_0) {
-        loadLE<uint32_t, 32>(data + offset, m->h.sid);
-        offset += 4;
-        readableSize -= 4;
-    }
-    if(m->h.type > rtmp::TYPE_METADATA) {
-        SPDLOG_ERROR("RTMP session {}, invalid message type {}", (void *)this, m->h.type);
+    doReadChunk();
+}
+
+void RtmpSession::doReadChunkPayload(uint32_t size)
+{
+    auto self(shared_from_this());
+    boost::asio::async_read(socket_, boost::asio::buffer(demuxer_.payloadBuffer(), size),
+    [this, self, size](boost::system::error_code ec, std::size_t) {
+        if(!ec) {
+            onBytesRead(size);
+            bool ok = onChunkResult(demuxer_.commitPayload(size));
+            server_->flushWrites();
+            if(moveTo_) {
+                moveWhenIdle();
+            } else if(ok) {
+                doReadChunk();
+            }
+        } else if(ec != boost::asio::error::operation_aborted) {
+            stopSession();
+        }
+    });
+}
+
+bool RtmpSession::onChunkResult(ChunkDemuxer::Result result)
+{
+    if(result == ChunkDemuxer::Result::ERROR) {
+        SPDLOG_ERROR("RTMP session {}, {}", (void *)this, demuxer_.error());
         stopSession();
         return false;
     }
-    // possible extended timestamp
-    uint32_t extended = m->h.timestamp;
-    if(m->h.timestamp == 0xffffff) {
-        if(readableSize < 4) {
+    if(result == ChunkDemuxer::Result::MESSAGE) {
+        messagesRead_++;
+        Metrics::local().rtmpMessagesIn.add();
+        if(!onMessage(demuxer_.message())) {
+            stopSession();
             return false;
         }
-        loadBE<uint32_t, 32>(data + offset, extended);
-        offset += 4;
-        readableSize -= 4;
-    }
-    // initialize the message, in case of first chunk
-    if(m->payload.readableSize() == 0) {
-        if(rtmp::CHUNK_TYPE_0 == chunkHeaderFmt_) {
-            m->h.clock = extended;
-        } else {
-            m->h.clock += extended;
-        }
-        m->payload.reserve(m->h.length);
     }
-    inBuffer_.erase(offset);
-    readingChunkHeader_ = false;
     return true;
 }
 
-bool RtmpSession::decodeChunkPayload()
-{
-    const uint8_t *data = inBuffer_.readBuffer();
-    uint32_t readableSize = inBuffer_.readableSize();
-    auto m = getMessage(chunkHeaderCid_);
-    uint32_t size = std::min((m->h.length - m->payload.readableSize()),
-                             (inChunkSize_ - (m->payload.readableSize() % inChunkSize_)));
-    size = std::min(readableSize, size);
-    m->payload.append(data, size);
-    inBuffer_.erase(size);
-    if(m->payload.readableSize() >= m->h.length) {
-        if(m->h.clock > 0xffffffff) {
-            // ignore message
-            SPDLOG_INFO("RTMP session {}, ignored message with invalid clock, type={}, size={}", (void *)this, m->h.type, m->h.length);
-        } else {
-            if(!onMessage(m)) {
-                stopSession();
-                return false;
-            }
-        }
-        m->payload.clear();
-        readingChunkHeader_ = true;
-    } else if(0 == (m->payload.readableSize() % inChunkSize_)) {
-        readingChunkHeader_ = true;
-    } else {
-        // incomplete chunk body, keep state
+void RtmpSession::onBytesRead(std::size_t n)
+{
+    bytesRead_ += n;
+    lastRead_ = server_->timerWheel().now();
+    Metrics::local().rtmpBytesIn.add(n);
+    if(windowAckSize_ > 0 && bytesRead_ - bytesAcked_ >= windowAckSize_) {
+        rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
+        enc.encodeAck(static_cast<uint32_t>(bytesRead_));
+        bytesAcked_ = bytesRead_;
+        doWrite();
     }
-    return true;
 }
 
-RtmpMessage *RtmpSession::getMessage(uint32_t cid)
+void RtmpSession::watchTimeouts()
 {
-    uint32_t pos = cid % RTMP_MAX_CHANNELS;
-    if(inMessages_[pos].h.cid == 0 || inMessages_[pos].h.cid == cid) {
-        inMessages_[pos].h.cid = cid;
-        return &inMessages_[pos];
+    TimerWheel &wheel = server_->timerWheel();
+    startTick_ = lastRead_ = wheel.now();
+    if(FLAGS_rtmp_handshake_timeout == 0 && FLAGS_rtmp_idle_timeout == 0 && FLAGS_rtmp_write_timeout == 0) {
+        return;
     }
-    for(pos = 0; pos < RTMP_MAX_CHANNELS; pos++) {
-        if(inMessages_[pos].h.cid == 0) {
-            inMessages_[pos].h.cid = cid;
-            return &inMessages_[pos];
+    // the wheel only holds a weak reference, a closed or moved session drops out on its next check
+    wheel.schedule(std::max(FLAGS_rtmp_handshake_timeout, 1u), [weak = weak_from_this(), &wheel]() -> uint32_t {
+        auto self = weak.lock();
+        return self && &self->server_->timerWheel() == &wheel ? self->checkTimeouts() : 0;
+    });
+}
+
+uint32_t RtmpSession::checkTimeouts()
+{
+    if(stopped_ || closed_) {
+        return 0;
+    }
+    uint64_t now = server_->timerWheel().now();
+    uint64_t next = std::numeric_limits<uint64_t>::max();
+    const char *expired = nullptr;
+    auto deadline = [&](bool active, uint32_t timeout, uint64_t since, const char *what) {
+        if(!active || timeout == 0) {
+            return;
+        }
+        if(now >= since + timeout) {
+            expired = what;
+        } else {
+            next = std::min(next, since + timeout - now);
         }
+    };
+    deadline(!connected_, FLAGS_rtmp_handshake_timeout, startTick_, "handshake");
+    deadline(connected_ && dir_ == Direction::INPUT, FLAGS_rtmp_idle_timeout, lastRead_, "idle");
+    deadline(writePending_, FLAGS_rtmp_write_timeout, writeSince_, "write");
+    if(expired) {
+        SPDLOG_WARN("RTMP session {}, {} timeout, closing", (void *)this, expired);
+        stopSession();
+        return 0;
+    }
+    if(next == std::numeric_limits<uint64_t>::max()) {
+        // no write pending, one may start at any time: caught within 1.5 timeouts,
+        // never less than a tick as 0 would take the session off the wheel
+        return std::max(FLAGS_rtmp_write_timeout / 2, server_->timerWheel().tick());
+    }
+    return static_cast<uint32_t>(next);
+}
+
+void RtmpSession::onConnected()
+{
+    if(!connected_) {
+        connected_ = true;
+        Metrics::local().connect.observe(std::chrono::steady_clock::now() - startTime_);
     }
-    return nullptr;
 }
 
 bool RtmpSession::onMessage(RtmpMessage *m)
 {
     switch(m->h.type) {
     case rtmp::TYPE_SET_CHUNK_SIZE:
-        if(m->payload.readableSize() >= 4) {
-            loadBE<uint32_t, 32>(m->payload.readBuffer(), inChunkSize_);
-            SPDLOG_DEBUG("RTMP session {}, chunk size changed to {}", (void *)this, inChunkSize_);
+        if(m->payload->readableSize() >= 4) {
+            uint32_t size;
+            loadBE<uint32_t, 32>(m->payload->readBuffer(), size);
+            size &= 0x7fffffff;
+            if(size == 0) {
+                SPDLOG_ERROR("RTMP session {}, invalid chunk size 0", (void *)this);
+                return false;
+            }
+            demuxer_.setChunkSize(size);
+            SPDLOG_DEBUG("RTMP session {}, chunk size changed to {}", (void *)this, size);
         }
         break;
     case rtmp::TYPE_ABORT:
         break;
     case rtmp::TYPE_ACKNOWLEDGEMENT:
-        if(m->payload.readableSize() >= 4) {
+        if(m->payload->readableSize() >= 4) {
             uint32_t bytes;
-            loadBE<uint32_t, 32>(m->payload.readBuffer(), bytes);
+            loadBE<uint32_t, 32>(m->payload->readBuffer(), bytes);
             SPDLOG_DEBUG("RTMP session {}, bytes read: {}", (void *)this, bytes);
         }
         break;
     case rtmp::TYPE_EVENT:
-        if(m->payload.readableSize() >= 6) {
+        if(m->payload->readableSize() >= 6) {
             uint16_t arg;
             uint32_t param;
-            loadBE<uint16_t, 16>(m->payload.readBuffer(), arg);
-            loadBE<uint32_t, 32>(m->payload.readBuffer() + 2, param);
+            loadBE<uint16_t, 16>(m->payload->readBuffer(), arg);
+            loadBE<uint32_t, 32>(m->payload->readBuffer() + 2, param);
             SPDLOG_DEBUG("RTMP session {}, event {}, param {}", (void *)this, arg, param);
             if(arg == rtmp::EVENT_PING_REQUEST) {
                 // echo as EVENT_PING_RESPONSE
-                rtmp::MessageEncoder enc(outBuffer_);
+                rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
                 enc.encodePingResponse(timeNow());
                 doWrite();
             }
         }
         break;
     case rtmp::TYPE_WINDOW_ACKNOWLEDGEMENT_SIZE:
-        if(m->payload.readableSize() >= 4) {
-            uint32_t bw;
-            loadBE<uint32_t, 32>(m->payload.readBuffer(), bw);
-            SPDLOG_DEBUG("RTMP session {}, winack {}", (void *)this, bw);
+        if(m->payload->readableSize() >= 4) {
+            loadBE<uint32_t, 32>(m->payload->readBuffer(), windowAckSize_);
+            SPDLOG_DEBUG("RTMP session {}, winack {}", (void *)this, windowAckSize_);
         }
         break;
     case rtmp::TYPE_SET_PEER_BANDWIDTH:
-        if(m->payload.readableSize() >= 5) {
+        if(m->payload->readableSize() >= 5) {
             uint32_t bw;
-            loadBE<uint32_t, 32>(m->payload.readBuffer(), bw);
-            SPDLOG_DEBUG("RTMP session {}, peer bw {}", (void *)this, bw, (int)(*m->payload.readBuffer()) + 4);
+            loadBE<uint32_t, 32>(m->payload->readBuffer(), bw);
+            SPDLOG_DEBUG("RTMP session {}, peer bw {}", (void *)this, bw, (int)(*m->payload->readBuffer()) + 4);
         }
         break;
     case rtmp::TYPE_FLEX_MESSAGE:
@@ -408,7 +472,7 @@ bool RtmpSession::onMessage(RtmpMessage *m)
 
 bool RtmpSession::onInvoke(RtmpMessage *m)
 {
-    std::string_view data = m->payload.stringView();
+    std::string_view data = m->payload->stringView();
     if(m->h.type == rtmp::TYPE_FLEX_MESSAGE) {
         data.remove_prefix(1);
     }
@@ -430,7 +494,7 @@ bool RtmpSession::onInvoke(RtmpMessage *m)
             return false;
         }
         app_ = args[0].val.s;
-        rtmp::MessageEncoder enc(outBuffer_);
+        rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
         enc.encodeWindowAck(5000000);
         enc.encodePeerBandwidth(5000000, rtmp::PEER_BANDWITH_LIMIT_TYPE_DYNAMIC);
         enc.encodeStreamBegin();
@@ -439,7 +503,7 @@ bool RtmpSession::onInvoke(RtmpMessage *m)
         enc.encodeConnectResult(trans_id.n);
         doWrite();
     } else if(command.s == std::string_view("createStream", 12)) {
-        rtmp::MessageEncoder enc(outBuffer_);
+        rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
         enc.encodeCreateStreamResult(trans_id.n);
         doWrite();
     } else if(command.s == std::string_view("publish", 7)) {
@@ -453,16 +517,11 @@ bool RtmpSession::onInvoke(RtmpMessage *m)
         if(!decoder.get(pub_type)) {
             return false;
         }
+        name_ = name.s;
         SPDLOG_DEBUG("RTMP session {}, publish {}, {}", (void *)this, name.toString(), pub_type.toString());
-        rtmp::MessageEncoder enc(outBuffer_);
-        enc.encodeOnStatusPublish(1);
-        doWrite();
-        dir_ = Direction::INPUT;
-        if(!server_.publish(shared_from_this())) {
-            stopSession();
-        }
+        return startPublish();
     } else if(command.s == std::string_view("play", 4)) {
-        rtmp::AmfItem null_obj, name;
+        rtmp::AmfItem null_obj, name, start;
         if(!decoder.get(null_obj)) {
             return false;
         }
@@ -471,11 +530,28 @@ bool RtmpSession::onInvoke(RtmpMessage *m)
         }
         name_ = name.s;
         SPDLOG_DEBUG("RTMP session {}, play {}", (void *)this, name.toString());
-        rtmp::MessageEncoder enc(outBuffer_);
+        if(!FLAGS_vod_path.empty() && app_ == FLAGS_vod_app) {
+            // start in seconds, -2 and -1 mean from the beginning
+            double ms = decoder.get(start) && start.type == rtmp::AMF0_NUMBER ? start.n * 1000 : 0;
+            return playVod(static_cast<uint32_t>(std::clamp(ms, 0.0, 4e9)));
+        }
+        rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
         enc.encodeOnStatusPlay(1);
         doWrite();
         dir_ = Direction::OUTPUT;
-        server_.subscribe(shared_from_this());
+        server_->subscribe(shared_from_this());
+        onConnected();
+    } else if(command.s == std::string_view("seek", 4)) {
+        rtmp::AmfItem null_obj, ms;
+        if(!decoder.get(null_obj)) {
+            return false;
+        }
+        if(!decoder.get(ms)) {
+            return false;
+        }
+        if(vod_ && ms.type == rtmp::AMF0_NUMBER) {
+            seekVod(static_cast<uint32_t>(std::clamp(ms.n, 0.0, 4e9)));
+        }
     } else if(command.s == std::string_view("deleteStream", 12)) {
         rtmp::AmfItem null_obj, sid;
         if(!decoder.get(null_obj)) {
@@ -485,26 +561,235 @@ bool RtmpSession::onInvoke(RtmpMessage *m)
             return false;
         }
         SPDLOG_DEBUG("RTMP session {}, deleteStream {}", (void *)this, sid.n);
+    } else if(command.s == std::string_view("releaseStream") || command.s == std::string_view("FCPublish")
+              || command.s == std::string_view("FCUnpublish")) {
+        SPDLOG_DEBUG("RTMP session {}, ignore {}", (void *)this, command.toString());
     } else if(command.s == std::string_view("onBWDone")) {
         SPDLOG_INFO("RTMP session {}, ignore onBWDone", (void *)this);
     } else if(command.s == std::string_view("_checkbw", 8)) {
-        rtmp::MessageEncoder enc(outBuffer_);
+        rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
         enc.encodeCheckBWResult(trans_id.n);
         doWrite();
     } else if(command.s == std::string_view("_result")) {
+        if(type_ == Type::CLIENT) {
+            return onResult(decoder, trans_id.n);
+        }
     } else if(command.s == std::string_view("onStatus")) {
+        if(type_ == Type::CLIENT) {
+            return onStatus(decoder);
+        }
+    } else if(command.s == std::string_view("_error")) {
+        SPDLOG_ERROR("RTMP session {}, peer error for transaction {}", (void *)this, trans_id.n);
+        return type_ != Type::CLIENT;
     } else {
         SPDLOG_ERROR("RTMP session {}, invalid command message {}", (void *)this, command.toString());
     }
     return true;
 }
 
+bool RtmpSession::startPublish()
+{
+    // the publisher runs on its stream's worker, busy streams do not pile up where they were accepted
+    RtmpServer *owner = moved_ ? server_ : server_->streamServer(app_, name_);
+    if(owner != server_) {
+        moveTo_ = owner;
+        return true;
+    }
+    rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
+    enc.encodeOnStatusPublish(1);
+    doWrite();
+    dir_ = Direction::INPUT;
+    if(!server_->publish(shared_from_this())) {
+        dir_ = Direction::NONE;
+        stopSession();
+    } else {
+        onConnected();
+    }
+    return true;
+}
+
+void RtmpSession::moveWhenIdle()
+{
+    // no read is pending, the write completion comes back here
+    if(stopped_ || closed_ || writePending_) {
+        return;
+    }
+    RtmpServer *target = moveTo_;
+    moveTo_ = nullptr;
+    moved_ = true;
+    boost::system::error_code ec;
+    auto protocol = socket_.local_endpoint(ec).protocol();
+    auto fd = ec ? boost::asio::ip::tcp::socket::native_handle_type() : socket_.release(ec);
+    if(ec) {
+        // Windows before 8.1 cannot release a socket, the stream is run from here then
+        SPDLOG_WARN("RTMP session {}, cannot move to worker {}, {}", (void *)this, target->index(), ec.message());
+        startPublish();
+        onChunks();
+        return;
+    }
+    SPDLOG_DEBUG("RTMP session {}, move from worker {} to {}", (void *)this, server_->index(), target->index());
+    Metrics::local().publishersMoved.add();
+    auto self(shared_from_this());
+    server_->release(self);
+    // from now on the timeouts of the old worker drop out, this thread no longer touches the session
+    server_ = target;
+    target->adopt(self, protocol, fd);
+}
+
+void RtmpSession::onMoved(boost::asio::ip::tcp::socket socket)
+{
+    socket_ = std::move(socket);
+    SPDLOG_INFO("RTMP session {}, moved to worker {} for {}/{}", (void *)this, server_->index(), app_, name_);
+    watchTimeouts();
+    startPublish();
+    onChunks();
+}
+
+bool RtmpSession::playVod(uint32_t ms)
+{
+    rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
+    auto file = server_->vodFile(name_);
+    if(!file) {
+        // the player gives up, or the handshake timeout closes it
+        enc.encodeOnStatus(1, "error", "NetStream.Play.StreamNotFound", "No such file");
+        doWrite();
+        return true;
+    }
+    SPDLOG_INFO("RTMP session {}, play file {} from {} ms", (void *)this, file->path(), ms);
+    enc.encodeStreamBegin();
+    enc.encodeOnStatusPlay(1);
+    doWrite();
+    dir_ = Direction::OUTPUT;
+    vod_ = std::make_unique<VodPlayer>(file);
+    vod_->seek(ms, server_->timerWheel().now());
+    onConnected();
+    watchVod();
+    return true;
+}
+
+void RtmpSession::seekVod(uint32_t ms)
+{
+    SPDLOG_DEBUG("RTMP session {}, seek to {} ms", (void *)this, ms);
+    // an ended playback no longer ticks
+    bool resume = vod_->ended();
+    // packets from the old position would run the timestamps backwards in the queue
+    sendQueue_.dropQueuedPackets();
+    // the player starts over: stream begin, then the headers again ahead of the key frame
+    vod_->seek(ms, server_->timerWheel().now());
+    rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
+    enc.encodeStreamBegin();
+    enc.encodeOnStatus(1, "status", "NetStream.Seek.Notify", "Seeking");
+    enc.encodeOnStatusPlay(1);
+    doWrite();
+    if(resume) {
+        watchVod();
+    }
+}
+
+void RtmpSession::watchVod()
+{
+    // ticks with the timeouts, the buffer time covers a tick
+    onVodTick();
+    server_->timerWheel().schedule(1, [weak = weak_from_this()]() -> uint32_t {
+        auto self = weak.lock();
+        return self ? self->onVodTick() : 0;
+    });
+}
+
+uint32_t RtmpSession::onVodTick()
+{
+    if(stopped_ || closed_ || vod_->ended()) {
+        return 0;
+    }
+    if(!vod_->file()->intact()) {
+        // truncated or rewritten under the mapping, reading on would fault
+        SPDLOG_ERROR("RTMP session {}, file {} changed while playing", (void *)this, vod_->file()->path());
+        rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
+        enc.encodeOnStatus(1, "error", "NetStream.Play.Failed", "File changed while playing");
+        enc.encodeStreamEof();
+        doWrite();
+        return 0;
+    }
+    // the rest waits for the socket instead of being dropped by the send queue
+    uint64_t now = server_->timerWheel().now();
+    while(sendQueue_.bytes() < 2 * FLAGS_rtmp_write_max_bytes) {
+        auto p = vod_->next(now);
+        if(!p) {
+            break;
+        }
+        sendPacket(p);
+    }
+    if(vod_->ended()) {
+        SPDLOG_INFO("RTMP session {}, end of file {}", (void *)this, vod_->file()->path());
+        rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
+        enc.encodeOnStatus(1, "status", "NetStream.Play.Stop", "Stopped playing");
+        enc.encodeStreamEof();
+        doWrite();
+        return 0;
+    }
+    return 1;
+}
+
+bool RtmpSession::onResult(rtmp::AmfDecoder &decoder, double tid)
+{
+    // client side: connect, then createStream, then play or publish
+    rtmp::MessageEncoder enc(outBuffer_, outChunkSize_);
+    if(tid == rtmp::TRANSACTION_ID_CLIENT_CONNECT) {
+        if(dir_ == Direction::OUTPUT) {
+            enc.encodeReleaseStream(name_.c_str(), rtmp::TRANSACTION_ID_CLIENT_RELEASE_STREAM);
+            enc.encodeFcPublish(name_.c_str(), rtmp::TRANSACTION_ID_CLIENT_FC_PUBLISH);
+        }
+        enc.encodeCreateStream(rtmp::TRANSACTION_ID_CLIENT_CREATE_STREAM);
+    } else if(tid == rtmp::TRANSACTION_ID_CLIENT_CREATE_STREAM) {
+        rtmp::AmfItem null_obj, sid;
+        if(!decoder.get(null_obj) || !decoder.get(sid) || sid.type != rtmp::AMF0_NUMBER) {
+            SPDLOG_ERROR("RTMP session {}, invalid createStream result", (void *)this);
+            return false;
+        }
+        streamId_ = static_cast<uint32_t>(sid.n);
+        if(dir_ == Direction::OUTPUT) {
+            SPDLOG_INFO("RTMP session {}, publish {}/{} on stream {}", (void *)this, app_, name_, streamId_);
+            enc.encodePublish("live", name_.c_str(), streamId_, rtmp::TRANSACTION_ID_CLIENT_PUBLISH);
+        } else {
+            SPDLOG_INFO("RTMP session {}, play {}/{} on stream {}", (void *)this, app_, name_, streamId_);
+            enc.encodePlay(name_.c_str(), streamId_, rtmp::TRANSACTION_ID_CLIENT_PLAY);
+        }
+    }
+    doWrite();
+    return true;
+}
+
+bool RtmpSession::onStatus(rtmp::AmfDecoder &decoder)
+{
+    rtmp::AmfItem null_obj;
+    rtmp::AmfValue info[2] = { std::string_view("level"), std::string_view("code") };
+    if(!decoder.get(null_obj) || !decoder.get(info, 2)) {
+        return false;
+    }
+    SPDLOG_INFO("RTMP session {}, status {}", (void *)this, info[1].toString());
+    if(info[0].val.type == rtmp::AMF0_STRING && info[0].val.s == std::string_view("error")) {
+        SPDLOG_ERROR("RTMP session {}, {}/{} failed on the peer", (void *)this, app_, name_);
+        return false;
+    }
+    if(dir_ == Direction::OUTPUT && info[1].val.type == rtmp::AMF0_STRING
+       && info[1].val.s == std::string_view("NetStream.Publish.Start")) {
+        // the stream bursts its caches, then fans out to this session like to a viewer
+        onConnected();
+        stream_->onPushStarted(shared_from_this());
+    } else if(dir_ == Direction::INPUT && info[1].val.type == rtmp::AMF0_STRING
+              && info[1].val.s == std::string_view("NetStream.Play.Start")) {
+        onConnected();
+    }
+    return true;
+}
+
 bool RtmpSession::onNotify(RtmpMessage *m)
 {
     if(dir_ != Direction::INPUT) {
-        return false;
+        // upstream servers may notify a publishing client, nothing to do with it
+        return type_ == Type::CLIENT;
     }
-    std::string_view data = m->payload.stringView();
+    std::string_view data = m->payload->stringView();
     if(m->h.type == rtmp::TYPE_FLEX_STREAM) {
         data.remove_prefix(1);
     }
@@ -519,74 +804,132 @@ bool RtmpSession::onNotify(RtmpMessage *m)
             return false;
         }
         if(arg1.s == std::string_view("onMetaData", 10)) {
-            return stream_->onMeta(data);
+            // only the metadata object, the stream adds its own wrapper
+            return stream_->onMeta(FrameSlice(m->payload).slice(decoder.remaining()));
         } else {
             return false;
         }
     } else if(command.s == std::string_view("onMetaData", 10)) {
-        return stream_->onMeta(data);
+        return stream_->onMeta(FrameSlice(m->payload).slice(decoder.remaining()));
     } else if(command.s == std::string_view("onTextData", 10)) {
         return stream_->onText(m->h.clock, data);
     } else {
-        return false;
+        // origins send players extra notifications like |RtmpSampleAccess
+        return type_ == Type::CLIENT;
     }
     return true;
 }
 
-void RtmpSession::sendAudioHeader(Buffer *audio)
+void RtmpSession::sendPacket(const std::shared_ptr<StreamPacket> &p)
 {
-    rtmp::MessageEncoder enc(outBuffer_);
-    enc.encodeMessage(*audio, rtmp::TYPE_AUDIO, rtmp::CID_AUDIO, rtmp::MSID_DEFAULT, 0);
-    doWrite();
+    switch(sendQueue_.admit(p)) {
+    case SendQueue::Admit::ACCEPT:
+        break;
+    case SendQueue::Admit::DROP:
+        return;
+    case SendQueue::Admit::EVICT: {
+        SPDLOG_WARN("RTMP session {}, over the send queue limit for too long, evicted", (void *)this);
+        Metrics::local().evicted.add();
+        // not from inside the stream's fanout loop
+        auto self(shared_from_this());
+        boost::asio::post(socket_.get_executor(), [self]() {
+            self->stopSession();
+        });
+        return;
+    }
+    }
+    sendQueue_.push(outBuffer_);
+    sendQueue_.push(p);
+    packetsWritten_++;
+    Metrics::local().rtmpMessagesOut.add();
+    if(!flushPending_) {
+        flushPending_ = true;
+        server_->deferWrite(shared_from_this());
+    }
 }
 
-void RtmpSession::sendAudio(uint32_t timestamp, std::string_view audio)
+void RtmpSession::flush()
 {
-    rtmp::MessageEncoder enc(outBuffer_);
-    enc.encodeMessage(audio, rtmp::TYPE_AUDIO, rtmp::CID_AUDIO, rtmp::MSID_DEFAULT, timestamp);
-    doWrite();
+    flushPending_ = false;
+    if(!closed_) {
+        doWrite();
+    }
 }
 
-void RtmpSession::sendVideoHeader(Buffer *video)
+void RtmpSession::collectMetrics(const std::string &labels, SessionMetrics &out)
 {
-    rtmp::MessageEncoder enc(outBuffer_);
-    enc.encodeMessage(*video, rtmp::TYPE_VIDEO, rtmp::CID_VIDEO, rtmp::MSID_DEFAULT, 0);
+    out.queueBytes += sendQueue_.bytes();
+    if(!out.detailed) {
+        return;
+    }
+    char session[64];
+    snprintf(session, sizeof(session), ",protocol=\"rtmp\",session=\"%p\"}", (void *)this);
+    std::string l = labels + session;
+    out.add(SessionMetrics::BYTES_IN, l, bytesRead_);
+    out.add(SessionMetrics::BYTES_OUT, l, bytesWritten_);
+    out.add(SessionMetrics::MESSAGES_IN, l, messagesRead_);
+    out.add(SessionMetrics::MESSAGES_OUT, l, packetsWritten_);
+    out.add(SessionMetrics::QUEUE_BYTES, l, sendQueue_.bytes());
+    out.add(SessionMetrics::DROPPED_VIDEO, l, sendQueue_.droppedVideo());
+    out.add(SessionMetrics::DROPPED_AUDIO, l, sendQueue_.droppedAudio());
 }
 
-void RtmpSession::sendVideo(uint32_t timestamp, std::string_view video)
+void RtmpSession::encodeFraming(SendEntry &e)
 {
-    rtmp::MessageEncoder enc(outBuffer_);
-    enc.encodeMessage(video, rtmp::TYPE_VIDEO, rtmp::CID_VIDEO, rtmp::MSID_DEFAULT, timestamp);
+    // in wire order, entries dropped from the queue never touch the chunk stream state
+    const StreamPacket &p = *e.packet;
+    assert(p.cid < RTMP_MAX_CHANNELS);
+    rtmp::ChunkStreamState &state = outChannels_[p.cid];
+    e.headSize = rtmp::encodeChunkHeader(e.head, state, p.type, p.payload.size(), p.cid, streamId_, p.timestamp);
+    e.tailSize = rtmp::encodeChunkHeader3(e.tail, p.cid, state.field);
 }
 
-void RtmpSession::sendMetaData(std::string_view metaData)
+uint32_t RtmpSession::segments(const SendEntry &e)
 {
-    rtmp::MessageEncoder enc(outBuffer_);
-    enc.encodeMeta(metaData);
-    doWrite();
+    // a chunk header before every chunk of the payload
+    uint32_t chunks = (e.packet->payload.size() + outChunkSize_ - 1) / outChunkSize_;
+    return chunks == 0 ? 1 : 2 * chunks;
 }
 
-void RtmpSession::doWrite()
+boost::asio::const_buffer RtmpSession::buffer(const SendEntry &e, uint32_t segment)
 {
-    if(!writing_) {
-        if(outBuffer_.readableSize() > 0) {
-            outBuffer_.swap(outBufferFlush_);
-            outBuffer_.clear();
-            writing_ = true;
-            auto self(shared_from_this());
-            boost::asio::async_write(socket_,
-                                     boost::asio::buffer(outBufferFlush_.readBuffer(), outBufferFlush_.readableSize()),
-            [this, self](const boost::system::error_code & ec, std::size_t) {
-                if(!ec) {
-                    outBufferFlush_.clear();
-                    writing_ = false;
-                    doWrite();
-                } else if(ec != boost::asio::error::operation_aborted) {
-                    SPDLOG_ERROR("RTMP session {}, fail to write", (void *)this);
-                    stopSession();
-                }
-            });
+    uint32_t chunk = segment / 2;
+    if(0 == (segment % 2)) {
+        if(0 == chunk) {
+            return boost::asio::const_buffer(e.head, e.headSize);
         }
+        return boost::asio::const_buffer(e.tail, e.tailSize);
+    }
+    const FrameSlice &payload = e.packet->payload;
+    uint32_t offset = chunk * outChunkSize_;
+    return boost::asio::const_buffer(payload.data() + offset, std::min(outChunkSize_, payload.size() - offset));
+}
+
+void RtmpSession::doWrite()
+{
+    sendQueue_.push(outBuffer_);
+    if(!sendQueue_.gather()) {
+        return;
     }
+    writePending_ = true;
+    writeSince_ = server_->timerWheel().now();
+    Metrics::local().rtmpWrites.add();
+    auto self(shared_from_this());
+    boost::asio::async_write(socket_, sendQueue_.buffers(),
+    [this, self](const boost::system::error_code & ec, std::size_t n) {
+        writePending_ = false;
+        if(!ec) {
+            bytesWritten_ += n;
+            Metrics::local().rtmpBytesOut.add(n);
+            sendQueue_.consume();
+            doWrite();
+            if(moveTo_) {
+                moveWhenIdle();
+            }
+        } else if(ec != boost::asio::error::operation_aborted) {
+            SPDLOG_ERROR("RTMP session {}, fail to write", (void *)this);
+            stopSession();
+        }
+    });
 }
 }
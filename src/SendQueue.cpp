@@ -0,0 +1,206 @@
+#include <chrono>
+#include <spdlog/spdlog.h>
+#include "SendQueue.hpp"
+#include "Rtmp.hpp"
+#include "Metrics.hpp"
+#include "Conf.hpp"
+
+namespace ms777 {
+static inline uint64_t steadyNow()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>
+           (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+SendQueue::SendQueue(SendFraming &framing) : framing_(framing)
+{
+}
+
+SendQueue::Admit SendQueue::admit(const std::shared_ptr<StreamPacket> &p)
+{
+    if(p->header || (p->type != rtmp::TYPE_AUDIO && p->type != rtmp::TYPE_VIDEO)) {
+        return Admit::ACCEPT;
+    }
+    bool over = overLimit(p->timestamp);
+    if(over) {
+        uint64_t now = steadyNow();
+        if(overLimitSince_ == 0) {
+            overLimitSince_ = now;
+        } else if(FLAGS_rtmp_sub_evict_timeout > 0 && (now - overLimitSince_) > FLAGS_rtmp_sub_evict_timeout) {
+            return Admit::EVICT;
+        }
+        if(!skipVideo_) {
+            SPDLOG_DEBUG("Send queue {}, over limit ({} bytes), skip to the next key frame", (void *)this, bytes_);
+            skipVideo_ = true;
+            dropQueuedVideo();
+            over = overLimit(p->timestamp);
+        }
+    } else {
+        overLimitSince_ = 0;
+    }
+    if(p->type == rtmp::TYPE_VIDEO) {
+        if(skipVideo_) {
+            if(!p->keyFrame || over) {
+                droppedVideo_++;
+                Metrics::local().droppedVideo.add();
+                return Admit::DROP;
+            }
+            skipVideo_ = false;
+        }
+        return Admit::ACCEPT;
+    }
+    // audio is kept unless dropping video was not enough
+    if(over) {
+        droppedAudio_++;
+        Metrics::local().droppedAudio.add();
+        return Admit::DROP;
+    }
+    return Admit::ACCEPT;
+}
+
+bool SendQueue::overLimit(uint32_t timestamp)
+{
+    if(FLAGS_rtmp_sub_queue_max_size > 0 && bytes_ > FLAGS_rtmp_sub_queue_max_size) {
+        return true;
+    }
+    if(FLAGS_rtmp_sub_queue_max_duration > 0) {
+        for(auto &e : entries_) {
+            if(e.packet && !e.packet->header) {
+                // signed, timestamps may step back on interleave, republish or seek
+                int32_t queued = static_cast<int32_t>(timestamp - e.packet->timestamp);
+                return queued > 0 && static_cast<uint32_t>(queued) > FLAGS_rtmp_sub_queue_max_duration;
+            }
+        }
+    }
+    return false;
+}
+
+void SendQueue::dropQueuedVideo()
+{
+    // entries in the pending write must stay, the rest are only marked so nothing moves
+    std::size_t i = writing_ ? writeEntries_ + 1 : 0;
+    for(; i < entries_.size(); i++) {
+        SendEntry &e = entries_[i];
+        if(e.packet && e.segment == 0 && e.packet->type == rtmp::TYPE_VIDEO && !e.packet->header && !e.packet->keyFrame) {
+            bytes_ -= e.size;
+            e.size = 0;
+            e.packet.reset();
+            droppedVideo_++;
+            Metrics::local().droppedVideo.add();
+        }
+    }
+}
+
+void SendQueue::dropQueuedPackets()
+{
+    // as for video, encoded bytes and the pending write stay
+    std::size_t i = writing_ ? writeEntries_ + 1 : 0;
+    for(; i < entries_.size(); i++) {
+        SendEntry &e = entries_[i];
+        if(e.packet && e.segment == 0) {
+            bytes_ -= e.size;
+            e.size = 0;
+            e.packet.reset();
+        }
+    }
+    skipVideo_ = false;
+    overLimitSince_ = 0;
+}
+
+void SendQueue::push(const std::shared_ptr<StreamPacket> &p)
+{
+    SendEntry &e = entries_.emplace_back();
+    e.packet = p;
+    e.size = p->payload.size();
+    bytes_ += e.size;
+}
+
+void SendQueue::push(Buffer &bytes)
+{
+    if(bytes.readableSize() > 0) {
+        auto f = Frame::create(0);
+        f->buffer().swap(bytes);
+        SendEntry &e = entries_.emplace_back();
+        e.size = f->readableSize();
+        e.bytes = FrameSlice(std::move(f));
+        bytes_ += e.size;
+    }
+}
+
+void SendQueue::push(const FrameSlice &bytes)
+{
+    if(!bytes.empty()) {
+        SendEntry &e = entries_.emplace_back();
+        e.size = bytes.size();
+        e.bytes = bytes;
+        bytes_ += e.size;
+    }
+}
+
+uint32_t SendQueue::segments(const SendEntry &e)
+{
+    if(!e.packet) {
+        return e.bytes.empty() ? 0 : 1;
+    }
+    return framing_.segments(e);
+}
+
+boost::asio::const_buffer SendQueue::buffer(const SendEntry &e, uint32_t segment)
+{
+    if(!e.packet) {
+        return boost::asio::const_buffer(e.bytes.data(), e.bytes.size());
+    }
+    return framing_.buffer(e, segment);
+}
+
+bool SendQueue::gather()
+{
+    if(writing_ || entries_.empty()) {
+        return false;
+    }
+    buffers_.clear();
+    writeEntries_ = 0;
+    writeResume_ = 0;
+    std::size_t bytes = 0;
+    for(auto &e : entries_) {
+        uint32_t segments = this->segments(e);
+        uint32_t s = e.segment;
+        for(; s < segments; s++) {
+            if(!buffers_.empty() && (buffers_.size() >= FLAGS_rtmp_write_max_iovecs
+                                     || bytes >= FLAGS_rtmp_write_max_bytes)) {
+                break;
+            }
+            if(s == 0 && e.packet) {
+                framing_.encodeFraming(e);
+            }
+            buffers_.push_back(buffer(e, s));
+            bytes += buffers_.back().size();
+        }
+        if(s < segments) {
+            writeResume_ = s;
+            break;
+        }
+        writeEntries_++;
+    }
+    if(buffers_.empty()) {
+        // only dropped entries
+        entries_.clear();
+        bytes_ = 0;
+        return false;
+    }
+    writing_ = true;
+    return true;
+}
+
+void SendQueue::consume()
+{
+    for(std::size_t i = 0; i < writeEntries_; i++) {
+        bytes_ -= entries_.front().size;
+        entries_.pop_front();
+    }
+    if(writeResume_ > 0) {
+        entries_.front().segment = writeResume_;
+    }
+    writing_ = false;
+}
+}
@@ -1,11 +1,48 @@
+#include <thread>
 #include <spdlog/spdlog.h>
 #include "Server.hpp"
 #include "RtmpServer.hpp"
+#include "HttpServer.hpp"
+#include "DiskWriter.hpp"
+#include "VodFile.hpp"
+#include "Metrics.hpp"
+#include "Conf.hpp"
+
+#if defined(MS777_IO_URING)
+#include <boost/version.hpp>
+#if BOOST_VERSION < 107800 || !defined(BOOST_ASIO_HAS_IO_URING)
+#error "the io_uring option needs Boost 1.78 or later with BOOST_ASIO_HAS_IO_URING"
+#endif
+#if !__has_include(<liburing.h>)
+#error "the io_uring option needs liburing and its headers"
+#endif
+#define MS777_IO_BACKEND "io_uring"
+#else
+#define MS777_IO_BACKEND "reactor"
+#endif
 
 namespace ms777 {
+static thread_local std::size_t currentWorker_ = 0;
+
 Server::Server()
-    : io_context_(1)
+    : diskWriter_(std::make_unique<DiskWriter>(FLAGS_record_threads))
 {
+    std::size_t n = FLAGS_server_threads;
+    if(n == 0) {
+        n = std::max(1u, std::thread::hardware_concurrency());
+    }
+    Metrics::init(n);
+    workerStreams_.reset(new std::atomic<std::size_t>[n]);
+    for(std::size_t i = 0; i < n; i++) {
+        workerStreams_[i] = 0;
+    }
+    for(std::size_t i = 0; i < n; i++) {
+        io_contexts_.emplace_back(std::make_unique<boost::asio::io_context>(1));
+    }
+    for(std::size_t i = 0; i < n; i++) {
+        rtmpServers_.emplace_back(std::make_unique<RtmpServer>(*this, i));
+        httpServers_.emplace_back(std::make_unique<HttpServer>(*this, i));
+    }
 }
 
 Server::~Server()
@@ -15,24 +52,215 @@ Server::~Server()
 
 void Server::run()
 {
-    RtmpServer rtmpServer(*this);
-    boost::asio::signal_set signals(io_context_);
-    signals.add(SIGINT);
-    signals.add(SIGTERM);
+    signals_ = std::make_unique<boost::asio::signal_set>(*io_contexts_[0]);
+    signals_->add(SIGINT);
+    signals_->add(SIGTERM);
 #if defined(SIGQUIT)
-    signals.add(SIGQUIT);
+    signals_->add(SIGQUIT);
 #endif
-    signals.async_wait(
-    [this, &rtmpServer](std::error_code /*ec*/, int signo) {
+    signals_->async_wait(
+    [this](const boost::system::error_code & ec, int signo) {
+        if(ec) {
+            // stopped by other means
+            return;
+        }
         SPDLOG_INFO("Stop server by signal {}", signo);
-        rtmpServer.stop();
+        stop();
     });
-    rtmpServer.start();
-    io_context_.run();
+    for(auto &s : rtmpServers_) {
+        s->start();
+    }
+    for(auto &s : httpServers_) {
+        s->start();
+    }
+    reapStreams();
+    SPDLOG_INFO("Server running {} workers, {} I/O", io_contexts_.size(), MS777_IO_BACKEND);
+    std::vector<std::thread> threads;
+    for(std::size_t i = 1; i < io_contexts_.size(); i++) {
+        threads.emplace_back([this, i]() {
+            currentWorker_ = i;
+            io_contexts_[i]->run();
+        });
+    }
+    currentWorker_ = 0;
+    io_contexts_[0]->run();
+    for(auto &t : threads) {
+        t.join();
+    }
+    for(auto &shard : streamShards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.streams.clear();
+    }
+}
+
+void Server::stop()
+{
+    // every worker closes its own acceptor and sessions on its own thread
+    for(std::size_t i = 0; i < rtmpServers_.size(); i++) {
+        RtmpServer *s = rtmpServers_[i].get();
+        HttpServer *h = httpServers_[i].get();
+        boost::asio::post(*io_contexts_[i], [s, h]() {
+            h->stop();
+            s->stop();
+        });
+    }
+    boost::asio::post(*io_contexts_[0], [this]() {
+        signals_->cancel();
+    });
+}
+
+std::size_t Server::workers()
+{
+    return io_contexts_.size();
+}
+
+boost::asio::io_context &Server::get_io_context(std::size_t worker)
+{
+    return *io_contexts_[worker];
+}
+
+RtmpServer &Server::rtmpServer(std::size_t worker)
+{
+    return *rtmpServers_[worker];
+}
+
+HttpServer &Server::httpServer(std::size_t worker)
+{
+    return *httpServers_[worker];
+}
+
+DiskWriter &Server::diskWriter()
+{
+    return *diskWriter_;
+}
+
+std::size_t Server::currentWorker()
+{
+    return currentWorker_;
+}
+
+std::shared_ptr<Stream> Server::getStream(const StreamKey &key)
+{
+    StreamShard &shard = streamShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto i = shard.streams.find(key);
+    if(i != shard.streams.end()) {
+        // about to be published or subscribed, the grace period starts over
+        i->second.idle = false;
+        return i->second.stream;
+    }
+    // streams created at once on other shards may pick the same worker, the next ones even it out
+    std::size_t worker = 0;
+    for(std::size_t w = 1; w < workers(); w++) {
+        if(workerStreams_[w] < workerStreams_[worker]) {
+            worker = w;
+        }
+    }
+    workerStreams_[worker]++;
+    auto stream = std::make_shared<Stream>(*this, key.app, key.name, worker);
+    shard.streams.emplace(stream->key(), StreamEntry{ stream });
+    return stream;
 }
 
-boost::asio::io_context &Server::get_io_context()
+std::shared_ptr<Stream> Server::findStream(const StreamKey &key)
 {
-    return io_context_;
+    StreamShard &shard = streamShard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto i = shard.streams.find(key);
+    return i != shard.streams.end() ? i->second.stream : nullptr;
+}
+
+std::vector<std::shared_ptr<Stream>> Server::streams()
+{
+    std::vector<std::shared_ptr<Stream>> result;
+    for(auto &shard : streamShards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for(auto &s : shard.streams) {
+            result.push_back(s.second.stream);
+        }
+    }
+    return result;
+}
+
+std::shared_ptr<VodFile> Server::vodFile(const std::string &name)
+{
+    // names stay below the directory
+    std::filesystem::path relative = std::filesystem::path(name).lexically_normal();
+    if(relative.empty() || relative.has_root_path() || *relative.begin() == "..") {
+        return nullptr;
+    }
+    std::string path = (std::filesystem::path(FLAGS_vod_path) / relative).string();
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(path, ec);
+    std::uintmax_t size = ec ? 0 : std::filesystem::file_size(path, ec);
+    if(ec) {
+        SPDLOG_WARN("VOD file {} not found", path);
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> lock(vodMutex_);
+        auto i = vodFiles_.find(path);
+        if(i != vodFiles_.end() && i->second.mtime == mtime && i->second.size == size) {
+            i->second.used = ++vodUses_;
+            return i->second.file;
+        }
+    }
+    // indexed outside the lock, a recording still growing is indexed again on its next play
+    auto file = VodFile::open(path);
+    if(!file || FLAGS_vod_cache_size == 0) {
+        return file;
+    }
+    std::lock_guard<std::mutex> lock(vodMutex_);
+    vodFiles_[path] = VodEntry{ file, mtime, size, ++vodUses_ };
+    while(vodFiles_.size() > FLAGS_vod_cache_size) {
+        // players keep their file mapped, only the cache lets go of it
+        auto oldest = vodFiles_.begin();
+        for(auto i = vodFiles_.begin(); i != vodFiles_.end(); ++i) {
+            if(i->second.used < oldest->second.used) {
+                oldest = i;
+            }
+        }
+        vodFiles_.erase(oldest);
+    }
+    return file;
+}
+
+void Server::reapStreams()
+{
+    if(FLAGS_stream_idle_timeout == 0) {
+        return;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto timeout = std::chrono::milliseconds(FLAGS_stream_idle_timeout);
+    std::vector<std::shared_ptr<Stream>> reclaimed; // released out of the lock
+    std::size_t live = 0;
+    for(auto &shard : streamShards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for(auto i = shard.streams.begin(); i != shard.streams.end();) {
+            StreamEntry &e = i->second;
+            if(!e.stream->idle()) {
+                e.idle = false;
+            } else if(!e.idle) {
+                e.idle = true;
+                e.idleSince = now;
+            } else if(now - e.idleSince >= timeout) {
+                // sessions and timers still holding it see it die with them
+                workerStreams_[e.stream->worker()]--;
+                reclaimed.push_back(std::move(e.stream));
+                i = shard.streams.erase(i);
+                continue;
+            }
+            ++i;
+        }
+        live += shard.streams.size();
+    }
+    if(!reclaimed.empty()) {
+        streamsReclaimed_.add(reclaimed.size());
+        SPDLOG_INFO("Server reclaimed {} idle streams, {} left", reclaimed.size(), live);
+    }
+    // idle streams are found within a second of their timeout
+    rtmpServers_[0]->runAfter(std::min(FLAGS_stream_idle_timeout, 1000u), [this]() {
+        reapStreams();
+    });
 }
 }
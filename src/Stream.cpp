@@ -1,11 +1,21 @@
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <sstream>
 #include <spdlog/spdlog.h>
 #include "Stream.hpp"
+#include "Server.hpp"
+#include "Recorder.hpp"
+#include "HlsSegmenter.hpp"
+#include "RtmpServer.hpp"
+#include "Rtmp.hpp"
+#include "Conf.hpp"
 
 namespace ms777 {
-Stream::Stream(std::string_view app, std::string_view name)
-    : app_(app), name_(name)
+Stream::Stream(Server &server, std::string_view app, std::string_view name, std::size_t worker)
+    : server_(server), app_(app), name_(name), key_(app_, name_), worker_(worker), shards_(new Shard[server.workers()])
 {
-    SPDLOG_INFO("Stream {} created for {}/{}", (void *)this, app, name);
+    SPDLOG_INFO("Stream {} created for {}/{} on worker {}", (void *)this, app, name, worker);
 }
 
 Stream::~Stream()
@@ -13,62 +23,414 @@ Stream::~Stream()
     SPDLOG_INFO("Stream {} is closed", (void *)this);
 }
 
-void Stream::stop()
+static bool wildcardMatch(std::string_view pattern, std::string_view s)
 {
-    SPDLOG_INFO("Stream {}, stop all sessions", (void *)this);
-    if(pub_) {
-        pub_->stop();
-        pub_.reset();
+    if(pattern.empty()) {
+        return s.empty();
     }
-    std::shared_ptr<RtmpSession> c = subs_.front();
+    if(pattern[0] == '*') {
+        for(std::size_t i = 0; i <= s.size(); i++) {
+            if(wildcardMatch(pattern.substr(1), s.substr(i))) {
+                return true;
+            }
+        }
+        return false;
+    }
+    if(s.empty() || (pattern[0] != '?' && pattern[0] != s[0])) {
+        return false;
+    }
+    return wildcardMatch(pattern.substr(1), s.substr(1));
+}
+
+// targets of --forward_targets for the app
+static std::vector<std::string> forwardTargets(const std::string &app)
+{
+    std::vector<std::string> targets;
+    std::stringstream list(FLAGS_forward_targets);
+    std::string entry;
+    while(std::getline(list, entry, ',')) {
+        std::size_t eq = entry.find('=');
+        if(eq != std::string::npos && eq + 1 < entry.size() && entry.substr(0, eq) == app) {
+            targets.push_back(entry.substr(eq + 1));
+        }
+    }
+    return targets;
+}
+
+bool Stream::match(const std::string &patterns, const std::string &app, const std::string &name)
+{
+    if(patterns.empty()) {
+        return false;
+    }
+    std::string stream = app + "/" + name;
+    std::stringstream list(patterns);
+    std::string pattern;
+    while(std::getline(list, pattern, ',')) {
+        if(!pattern.empty() && wildcardMatch(pattern, stream)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Stream::stop(std::size_t worker)
+{
+    SPDLOG_INFO("Stream {}, stop all sessions of worker {}", (void *)this, worker);
+    std::shared_ptr<RtmpSession> pub;
+    std::vector<Push> pushes;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(pub_ && pubWorker_ == worker) {
+            pub.swap(pub_);
+            recorder_.reset(); // stopped with the other sinks below
+            hlsLive_ = false;
+            pushes.swap(pushes_);
+        }
+    }
+    if(pub) {
+        pub->stop();
+    }
+    for(auto &push : pushes) {
+        if(push.session) {
+            push.session->stop();
+        }
+    }
+    Shard &shard = shards_[worker];
+    std::shared_ptr<StreamSink> c = shard.subs.front();
     while(c) {
         c->stop();
-        c = SpIntrusiveList<RtmpSession>::next(c);
+        c = SpIntrusiveList<StreamSink>::next(c);
     }
-    subs_.clear();
+    shard.subs.clear();
+    shard.size = 0;
 }
 
 void Stream::stop(std::shared_ptr<RtmpSession> c)
 {
     if(c->direction() == RtmpSession::Direction::INPUT) {
         SPDLOG_INFO("Stream {}, stop session {}, which is pub", (void *)this, (void *)c.get());
-        assert(c->get() == pub_.get());
-        pub_.reset();
+        std::shared_ptr<Recorder> recorder;
+        std::shared_ptr<HlsSegmenter> hls;
+        std::vector<Push> pushes;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(c != pub_) {
+                // already stopped by the stream, an idle pull
+                c->stop();
+                return;
+            }
+            pub_.reset();
+            // frames of this publish must not reach the sinks of the next one
+            gop_.clear();
+            gopSize_ = 0;
+            recorder.swap(recorder_);
+            pushes.swap(pushes_);
+            if(hlsLive_) {
+                hls = hls_; // kept to serve the ended playlist
+                hlsLive_ = false;
+                // ended before a republish can carry on from it
+                hls->stop();
+            }
+        }
+        // the file and the playlist end with the publishing session, they subscribed on this worker
+        if(recorder) {
+            unsubscribe(recorder);
+            recorder->stop();
+        }
+        if(hls) {
+            unsubscribe(hls);
+        }
+        for(auto &push : pushes) {
+            if(push.session) {
+                if(push.subscribed) {
+                    unsubscribe(push.session);
+                }
+                push.session->stop();
+            }
+        }
         c->stop();
+        if(c->type() == RtmpSession::Type::CLIENT && viewers() > 0 && !pullPending_.exchange(true)) {
+            // the pull from the origin failed or ended, viewers are still waiting
+            server_.rtmpServer(Server::currentWorker()).retryPull(shared_from_this());
+        }
+    } else if(c->type() == RtmpSession::Type::CLIENT) {
+        SPDLOG_INFO("Stream {}, stop session {}, which is forward", (void *)this, (void *)c.get());
+        stopPush(c);
     } else {
         SPDLOG_INFO("Stream {}, stop session {}, which is sub", (void *)this, (void *)c.get());
-        subs_.erase(c);
+        unsubscribe(c);
         c->stop();
     }
 }
 
 bool Stream::publish(std::shared_ptr<RtmpSession> c)
 {
-    if(pub_) {
-        SPDLOG_ERROR("Stream {}, already published, reject {}", (void *)this, (void *)c.get());
-        return false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(pub_) {
+            SPDLOG_ERROR("Stream {}, already published, reject {}", (void *)this, (void *)c.get());
+            return false;
+        }
+        SPDLOG_INFO("Stream {}, published by {}", (void *)this, (void *)c.get());
+        pub_ = c;
+        pubWorker_ = Server::currentWorker();
+    }
+    // the names come from the publisher and end up in the file path
+    bool record = match(FLAGS_record_streams, app_, name_);
+    if(record && !Recorder::validName(app_, name_)) {
+        SPDLOG_WARN("Stream {}, {}/{} is not recorded, not a valid file name", (void *)this, app_, name_);
+    } else if(record) {
+        auto recorder = std::make_shared<Recorder>(server_.diskWriter(), app_, name_);
+        subscribe(recorder);
+        std::lock_guard<std::mutex> lock(mutex_);
+        recorder_ = recorder;
+    }
+    if(match(FLAGS_hls_streams, app_, name_)) {
+        std::shared_ptr<HlsSegmenter> previous;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            previous = hls_;
+        }
+        auto hls = previous ? std::make_shared<HlsSegmenter>(app_, name_, *previous)
+                   : std::make_shared<HlsSegmenter>(app_, name_);
+        subscribe(hls);
+        std::lock_guard<std::mutex> lock(mutex_);
+        hls_ = hls;
+        hlsLive_ = true;
+    }
+    if(!FLAGS_forward_targets.empty()) {
+        std::vector<std::string> targets = forwardTargets(app_);
+        uint64_t epoch;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            epoch = ++epoch_;
+            for(auto &target : targets) {
+                pushes_.push_back(Push{ target });
+            }
+        }
+        for(std::size_t i = 0; i < targets.size(); i++) {
+            startPush(epoch, i);
+        }
     }
-    SPDLOG_INFO("Stream {}, published by {}", (void *)this, (void *)c.get());
-    pub_ = c;
     return true;
 }
 
-void Stream::subscribe(std::shared_ptr<RtmpSession> c)
+void Stream::startPush(uint64_t epoch, std::size_t index)
+{
+    std::string target;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(epoch != epoch_ || !pub_ || index >= pushes_.size() || pushes_[index].session) {
+            return;
+        }
+        target = pushes_[index].target;
+    }
+    auto c = server_.rtmpServer(Server::currentWorker()).push(shared_from_this(), target);
+    if(c) {
+        // connecting, the session calls back on this worker
+        std::lock_guard<std::mutex> lock(mutex_);
+        pushes_[index].session = c;
+    }
+}
+
+void Stream::onPushStarted(std::shared_ptr<RtmpSession> c)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto i = std::find_if(pushes_.begin(), pushes_.end(), [&c](const Push & p) {
+            return p.session == c;
+        });
+        if(i == pushes_.end() || i->subscribed) {
+            return;
+        }
+        i->subscribed = true;
+        i->failures = 0;
+    }
+    SPDLOG_INFO("Stream {}, forwarding to {}", (void *)this, (void *)c.get());
+    subscribe(c);
+}
+
+void Stream::stopPush(std::shared_ptr<RtmpSession> c)
+{
+    bool found = false, subscribed = false;
+    std::size_t index = 0;
+    uint64_t epoch = 0;
+    uint32_t delay = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for(index = 0; index < pushes_.size(); index++) {
+            if(pushes_[index].session == c) {
+                Push &push = pushes_[index];
+                found = true;
+                subscribed = push.subscribed;
+                push.session.reset();
+                push.subscribed = false;
+                // exponential backoff, a slow or dead upstream only costs its own retries
+                delay = std::min<uint64_t>(FLAGS_forward_retry_max,
+                                           (uint64_t)FLAGS_forward_retry_min << std::min<uint32_t>(push.failures, 16));
+                push.failures++;
+                epoch = epoch_;
+                break;
+            }
+        }
+    }
+    if(subscribed) {
+        unsubscribe(c);
+    }
+    c->stop();
+    if(found) {
+        SPDLOG_WARN("Stream {}, forward {} ended, reconnect in {} ms", (void *)this, (void *)c.get(), delay);
+        server_.rtmpServer(Server::currentWorker()).runAfter(delay, [self = shared_from_this(), epoch, index]() {
+            self->startPush(epoch, index);
+        });
+    }
+}
+
+bool Stream::published()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pub_ != nullptr;
+}
+
+void Stream::subscribe(std::shared_ptr<StreamSink> c)
 {
     SPDLOG_INFO("Stream {}, added sub {}", (void *)this, (void *)c.get());
-    subs_.addFront(c);
-    if(audioHeader_.readableSize() > 0) {
-        c->sendAudioHeader(&audioHeader_);
+    Shard &shard = shards_[Server::currentWorker()];
+    shard.subs.addFront(c);
+    shard.size = shard.subs.size();
+    // snapshot under the lock, packets with a later sequence arrive through fanout
+    std::vector<std::shared_ptr<StreamPacket>> burst;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        c->setJoinSeq(seq_);
+        burst.reserve(3 + gop_.size());
+        for(auto &p : { metaData_, audioHeader_, videoHeader_ }) {
+            if(p) {
+                burst.push_back(p);
+            }
+        }
+        burst.insert(burst.end(), gop_.begin(), gop_.end());
+    }
+    SPDLOG_DEBUG("Stream {}, burst {} packets to sub {}", (void *)this, burst.size(), (void *)c.get());
+    for(auto &p : burst) {
+        c->sendPacket(p);
+    }
+}
+
+void Stream::unsubscribe(std::shared_ptr<StreamSink> c)
+{
+    SPDLOG_DEBUG("Stream {}, removed sub {}", (void *)this, (void *)c.get());
+    Shard &shard = shards_[Server::currentWorker()];
+    shard.subs.erase(c);
+    shard.size = shard.subs.size();
+    stopIdlePull();
+}
+
+std::size_t Stream::viewers()
+{
+    std::size_t n = 0;
+    for(std::size_t w = 0; w < server_.workers(); w++) {
+        n += shards_[w].size;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t own = (recorder_ ? 1 : 0) + (hlsLive_ ? 1 : 0);
+    for(auto &push : pushes_) {
+        own += push.subscribed ? 1 : 0;
     }
-    if(videoHeader_.readableSize() > 0) {
-        c->sendVideoHeader(&videoHeader_);
+    return n > own ? n - own : 0;
+}
+
+bool Stream::idle()
+{
+    if(pullPending_) {
+        return false;
+    }
+    for(std::size_t w = 0; w < server_.workers(); w++) {
+        if(shards_[w].size > 0) {
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !pub_;
+}
+
+void Stream::stopIdlePull()
+{
+    // an edge stops pulling from the origin with its last viewer
+    std::shared_ptr<RtmpSession> pub;
+    std::size_t worker;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(!pub_ || pub_->type() != RtmpSession::Type::CLIENT) {
+            return;
+        }
+        pub = pub_;
+        worker = pubWorker_;
+    }
+    if(viewers() > 0) {
+        return;
+    }
+    SPDLOG_INFO("Stream {}, no viewers left, stop pulling", (void *)this);
+    boost::asio::post(server_.get_io_context(worker), [self = shared_from_this(), pub]() {
+        {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if(self->pub_ != pub) {
+                return;
+            }
+        }
+        if(self->viewers() == 0) {
+            self->stop(pub);
+        }
+    });
+}
+
+Stream::Stats Stream::stats()
+{
+    Stats st{};
+    st.published = published();
+    st.bytesIn = bytesIn_.value();
+    st.messagesIn = messagesIn_.value();
+    for(std::size_t w = 0; w < server_.workers(); w++) {
+        st.subscribers += shards_[w].size;
+        st.bytesOut += shards_[w].bytesOut.value();
+        st.messagesOut += shards_[w].messagesOut.value();
     }
+    return st;
+}
+
+void Stream::collectMetrics(std::size_t worker, SessionMetrics &out)
+{
+    std::string labels;
+    if(out.detailed) {
+        labels = "{app=" + Metrics::labelValue(app_) + ",name=" + Metrics::labelValue(name_);
+    }
+    auto c = shards_[worker].subs.front();
+    while(c) {
+        c->collectMetrics(labels, out);
+        c = SpIntrusiveList<StreamSink>::next(c);
+    }
+    std::shared_ptr<RtmpSession> pub;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(pub_ && pubWorker_ == worker) {
+            pub = pub_;
+        }
+    }
+    if(pub) {
+        pub->collectMetrics(labels, out);
+    }
+}
+
+std::shared_ptr<HlsSegmenter> Stream::hls()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return hls_;
 }
 
 bool Stream::isCodecHeader(RtmpMessage *m)
 {
-    if(m->payload.readableSize() >= 2) {
-        if(*(m->payload.readBuffer() + 1) == 0) {
+    if(m->payload->readableSize() >= 2) {
+        if(*(m->payload->readBuffer() + 1) == 0) {
             return true;
         }
     }
@@ -77,7 +439,7 @@ bool Stream::isCodecHeader(RtmpMessage *m)
 
 void Stream::dumpAudioFormat(RtmpMessage *m)
 {
-    uint8_t format = *m->payload.readBuffer();
+    uint8_t format = *m->payload->readBuffer();
     uint8_t codec = ((format & 0xf0) >> 4);
     uint32_t channels = (format & 0x01) + 1;
     uint32_t sampleSize = (format & 0x02) ? 2 : 1;
@@ -86,27 +448,26 @@ void Stream::dumpAudioFormat(RtmpMessage *m)
 
 void Stream::onAudio(RtmpMessage *m)
 {
+    bytesIn_.add(m->payload->readableSize());
+    messagesIn_.add();
     if(isCodecHeader(m)) {
         dumpAudioFormat(m);
-        audioHeader_.clear();
-        audioHeader_.append(m->payload.readBuffer(), m->payload.readableSize());
-        auto c = subs_.front();
-        while(c) {
-            c->sendAudioHeader(&audioHeader_);
-            c = SpIntrusiveList<RtmpSession>::next(c);
+        auto p = makePacket(rtmp::TYPE_AUDIO, 0, FrameSlice(m->payload));
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            p->header = true;
+            p->seq = ++seq_;
+            audioHeader_ = p;
         }
+        broadcast(p);
     } else {
-        auto c = subs_.front();
-        while(c) {
-            c->sendAudio(m->h.clock, m->payload.stringView());
-            c = SpIntrusiveList<RtmpSession>::next(c);
-        }
+        onFrame(rtmp::TYPE_AUDIO, m, false);
     }
 }
 
 void Stream::dumpVideoFormat(RtmpMessage *m, uint8_t &frameType)
 {
-    uint8_t format = *m->payload.readBuffer();
+    uint8_t format = *m->payload->readBuffer();
     frameType = (format & 0xf0) >> 4;
     uint8_t codec = format & 0x0f;
     SPDLOG_DEBUG("Stream {}, video codec {}, type {}", (void *)this, codec, frameType);
@@ -114,37 +475,180 @@ void Stream::dumpVideoFormat(RtmpMessage *m, uint8_t &frameType)
 
 void Stream::onVideo(RtmpMessage *m)
 {
+    bytesIn_.add(m->payload->readableSize());
+    messagesIn_.add();
     if(isCodecHeader(m)) {
         uint8_t frameType;
         dumpVideoFormat(m, frameType);
         if(frameType == 1) {
             // KEY FRAME
-            videoHeader_.clear();
-            videoHeader_.append(m->payload.readBuffer(), m->payload.readableSize());
-            auto c = subs_.front();
-            while(c) {
-                c->sendVideoHeader(&videoHeader_);
-                c = SpIntrusiveList<RtmpSession>::next(c);
+            auto p = makePacket(rtmp::TYPE_VIDEO, 0, FrameSlice(m->payload));
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                p->header = true;
+                p->seq = ++seq_;
+                videoHeader_ = p;
             }
+            broadcast(p);
         }
-    } else {
-        auto c = subs_.front();
-        while(c) {
-            c->sendVideo(m->h.clock, m->payload.stringView());
-            c = SpIntrusiveList<RtmpSession>::next(c);
+    } else if(m->payload->readableSize() > 0) {
+        uint8_t frameType = (*m->payload->readBuffer() & 0xf0) >> 4;
+        onFrame(rtmp::TYPE_VIDEO, m, frameType == 1);
+    }
+}
+
+void Stream::onFrame(uint8_t type, RtmpMessage *m, bool keyFrame)
+{
+    // gop_ is only modified on the publisher's thread, reading it here needs no lock
+    bool cache = FLAGS_rtmp_gop_cache && (keyFrame || !gop_.empty());
+    if(!cache && !hasSubscribers()) {
+        return;
+    }
+    auto p = makePacket(type, m->h.clock, FrameSlice(m->payload));
+    p->keyFrame = keyFrame;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        p->seq = ++seq_;
+        if(cache) {
+            cachePacket(p, keyFrame);
+        }
+    }
+    broadcast(p);
+}
+
+void Stream::cachePacket(const std::shared_ptr<StreamPacket> &p, bool keyFrame)
+{
+    if(keyFrame) {
+        gop_.clear();
+        gopSize_ = 0;
+    }
+    gop_.push_back(p);
+    gopSize_ += p->payload.size();
+    if(gopSize_ > FLAGS_rtmp_gop_cache_max_size) {
+        // a GOP without its key frame is useless, wait for the next one
+        SPDLOG_DEBUG("Stream {}, GOP cache exceeds {} bytes, dropped", (void *)this, FLAGS_rtmp_gop_cache_max_size);
+        gop_.clear();
+        gopSize_ = 0;
+    }
+}
+
+std::shared_ptr<StreamPacket> Stream::makePacket(uint8_t type, uint32_t timestamp, const FrameSlice &payload)
+{
+    auto p = std::make_shared<StreamPacket>();
+    p->type = type;
+    p->cid = (type == rtmp::TYPE_VIDEO) ? rtmp::CID_VIDEO : rtmp::CID_AUDIO;
+    p->timestamp = timestamp;
+    p->payload = payload;
+    return p;
+}
+
+bool Stream::hasSubscribers()
+{
+    for(std::size_t w = 0; w < server_.workers(); w++) {
+        if(shards_[w].size > 0) {
+            return true;
         }
     }
+    return false;
 }
 
-bool Stream::onMeta(std::string_view metaData)
+void Stream::broadcast(const std::shared_ptr<StreamPacket> &p)
 {
-    metaData_.clear();
-    metaData_.append(metaData);
-    auto c = subs_.front();
+    // subscribers on the publisher's worker are served inline, the other workers through their queue
+    std::size_t local = Server::currentWorker();
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t w = 0; w < server_.workers(); w++) {
+        if(shards_[w].size == 0) {
+            continue;
+        }
+        if(w == local) {
+            fanout(w, p);
+        } else {
+            handoff(w, p);
+        }
+    }
+    if(p->type == rtmp::TYPE_VIDEO) {
+        Metrics::local().fanout.observe(std::chrono::steady_clock::now() - start);
+    }
+}
+
+void Stream::fanout(std::size_t worker, const std::shared_ptr<StreamPacket> &p)
+{
+    Shard &shard = shards_[worker];
+    auto c = shard.subs.front();
+    uint64_t n = 0;
     while(c) {
-        c->sendMetaData(metaData_.stringView());
-        c = SpIntrusiveList<RtmpSession>::next(c);
+        if(p->seq > c->joinSeq()) {
+            c->sendPacket(p);
+            n++;
+        }
+        c = SpIntrusiveList<StreamSink>::next(c);
+    }
+    shard.messagesOut.add(n);
+    shard.bytesOut.add(n * p->payload.size());
+}
+
+void Stream::handoff(std::size_t worker, const std::shared_ptr<StreamPacket> &p)
+{
+    // only the publisher's worker pushes, the worker of the shard pops
+    Shard &shard = shards_[worker];
+    if(!p->header && (p->type == rtmp::TYPE_AUDIO || p->type == rtmp::TYPE_VIDEO)) {
+        // a stalled worker must not hold the stream's media without bound, drop
+        // as a send queue does: video until the next key frame, audio while full
+        bool full = FLAGS_rtmp_handoff_max_packets > 0 && shard.handoff.size() >= FLAGS_rtmp_handoff_max_packets;
+        if(p->type == rtmp::TYPE_VIDEO) {
+            shard.skipVideo = full || (shard.skipVideo && !p->keyFrame);
+            if(shard.skipVideo) {
+                Metrics::local().droppedVideo.add();
+                return;
+            }
+        } else if(full) {
+            Metrics::local().droppedAudio.add();
+            return;
+        }
+    }
+    shard.handoff.push(p);
+    // pairs with drain: either it sees the packet or this sees it done and posts again
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(!shard.draining.exchange(true)) {
+        boost::asio::post(server_.get_io_context(worker), [self = shared_from_this(), worker]() {
+            self->drain(worker);
+        });
+    }
+}
+
+void Stream::drain(std::size_t worker)
+{
+    Shard &shard = shards_[worker];
+    std::shared_ptr<StreamPacket> p;
+    for(;;) {
+        while(shard.handoff.pop(p)) {
+            fanout(worker, p);
+        }
+        shard.draining.store(false);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(shard.handoff.empty() || shard.draining.exchange(true)) {
+            return;
+        }
+    }
+}
+
+bool Stream::onMeta(const FrameSlice &metaData)
+{
+    // subscribers get the metadata wrapped as @setDataFrame
+    auto body = Frame::create(32 + metaData.size());
+    rtmp::AmfEncoder enc(body->buffer());
+    enc.putString(std::string_view("@setDataFrame", 13));
+    enc.putString(std::string_view("onMetaData", 10));
+    body->buffer().append(metaData.stringView());
+    auto p = makePacket(rtmp::TYPE_DATA, 0, FrameSlice(std::move(body)));
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        p->header = true;
+        p->seq = ++seq_;
+        metaData_ = p;
     }
+    broadcast(p);
     return true;
 }
 
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include "TimerWheel.hpp"
+
+namespace ms777 {
+TimerWheel::TimerWheel(boost::asio::io_context &io, uint32_t tickMs, uint32_t slots)
+    : timer_(io), tickMs_(std::max(tickMs, 1u)), slots_(std::max(slots, 1u))
+{
+}
+
+void TimerWheel::start()
+{
+    stopped_ = false;
+    start_ = std::chrono::steady_clock::now();
+    doTick();
+}
+
+void TimerWheel::stop()
+{
+    stopped_ = true;
+    timer_.cancel();
+    for(auto &slot : slots_) {
+        slot.clear();
+    }
+    size_ = 0;
+}
+
+void TimerWheel::schedule(uint32_t ms, Task task)
+{
+    if(stopped_) {
+        return;
+    }
+    insert(Entry{ now_ + ms, std::move(task) });
+}
+
+void TimerWheel::insert(Entry entry)
+{
+    // a slot up to a whole turn ahead, later deadlines wait there for more turns
+    uint64_t ticks = std::max<uint64_t>((entry.due - std::min(entry.due, now_) + tickMs_ - 1) / tickMs_, 1);
+    slots_[(tick_ + ticks) % slots_.size()].push_back(std::move(entry));
+    size_++;
+}
+
+void TimerWheel::doTick()
+{
+    timer_.expires_at(start_ + std::chrono::milliseconds((tick_ + 1) * tickMs_));
+    timer_.async_wait([this](const boost::system::error_code & ec) {
+        if(ec || stopped_) {
+            return;
+        }
+        onTick();
+        doTick();
+    });
+}
+
+void TimerWheel::onTick()
+{
+    now_ = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_).count();
+    // a busy loop catches up on the slots it missed
+    while(tick_ < now_ / tickMs_ && !stopped_) {
+        tick_++;
+        expired_.swap(slots_[tick_ % slots_.size()]);
+        size_ -= expired_.size();
+        for(auto &e : expired_) {
+            if(stopped_) {
+                break;
+            }
+            if(e.due > now_) {
+                insert(std::move(e));
+                continue;
+            }
+            uint32_t next = e.task();
+            if(next > 0) {
+                e.due = now_ + next;
+                insert(std::move(e));
+            }
+        }
+        expired_.clear();
+    }
+}
+}
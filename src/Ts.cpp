@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include "Ts.hpp"
+
+namespace ms777::ts {
+uint32_t crc32(const uint8_t *data, uint32_t size)
+{
+    // CRC-32/MPEG-2: polynomial 0x04c11db7, not reflected
+    uint32_t crc = 0xffffffff;
+    for(uint32_t i = 0; i < size; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for(int k = 0; k < 8; k++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+static void storeTimestamp(uint8_t *output, uint8_t prefix, uint64_t ts)
+{
+    output[0] = (prefix << 4) | (((ts >> 30) & 0x07) << 1) | 1;
+    output[1] = (ts >> 22) & 0xff;
+    output[2] = (((ts >> 15) & 0x7f) << 1) | 1;
+    output[3] = (ts >> 7) & 0xff;
+    output[4] = ((ts & 0x7f) << 1) | 1;
+}
+
+uint8_t Muxer::nextCounter(uint16_t pid)
+{
+    uint8_t &cc = counters_[pid == PID_PAT ? 0 : pid == PID_PMT ? 1 : pid == PID_VIDEO ? 2 : 3];
+    uint8_t value = cc;
+    cc = (cc + 1) & 0x0f;
+    return value;
+}
+
+void Muxer::writeSection(Buffer &output, uint16_t pid, const uint8_t *section, uint32_t size)
+{
+    assert(size + 1 <= PACKET_SIZE - 4);
+    output.reserve(PACKET_SIZE);
+    uint8_t *p = output.writeBuffer();
+    p[0] = 0x47;
+    p[1] = 0x40 | (pid >> 8); // payload unit start
+    p[2] = pid & 0xff;
+    p[3] = 0x10 | nextCounter(pid); // payload only
+    p[4] = 0; // pointer field
+    memcpy(p + 5, section, size);
+    memset(p + 5 + size, 0xff, PACKET_SIZE - 5 - size);
+    output.commit(PACKET_SIZE);
+}
+
+void Muxer::writeTables(Buffer &output, bool video, bool audio)
+{
+    uint8_t s[64];
+    // PAT: one program
+    uint32_t n = 0;
+    s[n++] = 0x00; // table id
+    s[n++] = 0xb0; // section syntax, length below
+    s[n++] = 0;
+    storeBE<uint16_t, 16>(s + n, 1); // transport stream id
+    n += 2;
+    s[n++] = 0xc1; // version 0, current
+    s[n++] = 0; // section number
+    s[n++] = 0; // last section number
+    storeBE<uint16_t, 16>(s + n, 1); // program number
+    storeBE<uint16_t, 16>(s + n + 2, 0xe000 | PID_PMT);
+    n += 4;
+    s[2] = n + 4 - 3;
+    storeBE<uint32_t, 32>(s + n, crc32(s, n));
+    writeSection(output, PID_PAT, s, n + 4);
+    // PMT: the elementary streams, the PCR goes with video if any
+    n = 0;
+    s[n++] = 0x02;
+    s[n++] = 0xb0;
+    s[n++] = 0;
+    storeBE<uint16_t, 16>(s + n, 1); // program number
+    n += 2;
+    s[n++] = 0xc1;
+    s[n++] = 0;
+    s[n++] = 0;
+    storeBE<uint16_t, 16>(s + n, 0xe000 | (video ? PID_VIDEO : PID_AUDIO)); // PCR PID
+    storeBE<uint16_t, 16>(s + n + 2, 0xf000); // program info length
+    n += 4;
+    if(video) {
+        s[n++] = STREAM_TYPE_H264;
+        storeBE<uint16_t, 16>(s + n, 0xe000 | PID_VIDEO);
+        storeBE<uint16_t, 16>(s + n + 2, 0xf000);
+        n += 4;
+    }
+    if(audio) {
+        s[n++] = STREAM_TYPE_AAC;
+        storeBE<uint16_t, 16>(s + n, 0xe000 | PID_AUDIO);
+        storeBE<uint16_t, 16>(s + n + 2, 0xf000);
+        n += 4;
+    }
+    s[2] = n + 4 - 3;
+    storeBE<uint32_t, 32>(s + n, crc32(s, n));
+    writeSection(output, PID_PMT, s, n + 4);
+}
+
+void Muxer::writePes(Buffer &output, uint16_t pid, uint8_t streamId, uint64_t pts, uint64_t dts,
+                     bool pcr, bool randomAccess, const uint8_t *data, uint32_t size)
+{
+    // PES header
+    uint8_t h[19];
+    uint32_t hn = 9;
+    h[0] = 0;
+    h[1] = 0;
+    h[2] = 1;
+    h[3] = streamId;
+    h[6] = 0x80; // marker bits
+    if(pts != dts) {
+        h[7] = 0xc0;
+        h[8] = 10;
+        storeTimestamp(h + 9, 0x3, pts);
+        storeTimestamp(h + 14, 0x1, dts);
+        hn += 10;
+    } else {
+        h[7] = 0x80;
+        h[8] = 5;
+        storeTimestamp(h + 9, 0x2, pts);
+        hn += 5;
+    }
+    uint32_t pesLength = hn - 6 + size;
+    storeBE<uint16_t, 16>(h + 4, (streamId == STREAM_ID_VIDEO || pesLength > 0xffff) ? 0 : pesLength);
+    // split header and data over TS packets
+    uint32_t total = hn + size, offset = 0;
+    bool first = true;
+    while(offset < total) {
+        output.reserve(PACKET_SIZE);
+        uint8_t *p = output.writeBuffer();
+        p[0] = 0x47;
+        p[1] = (first ? 0x40 : 0) | (pid >> 8);
+        p[2] = pid & 0xff;
+        // adaptation field: PCR on the first packet, stuffing on the last one
+        uint8_t af[PACKET_SIZE];
+        uint32_t afn = 0;
+        if(first && (pcr || randomAccess)) {
+            af[afn++] = 0; // length, set below
+            af[afn++] = (randomAccess ? 0x40 : 0) | (pcr ? 0x10 : 0);
+            if(pcr) {
+                uint64_t base = dts & 0x1ffffffffULL;
+                af[afn++] = base >> 25;
+                af[afn++] = base >> 17;
+                af[afn++] = base >> 9;
+                af[afn++] = base >> 1;
+                af[afn++] = ((base & 1) << 7) | 0x7e;
+                af[afn++] = 0;
+            }
+        }
+        uint32_t left = total - offset;
+        if(left < PACKET_SIZE - 4 - afn) {
+            uint32_t stuffing = PACKET_SIZE - 4 - afn - left;
+            if(afn == 0) {
+                af[afn++] = 0;
+                stuffing--;
+                if(stuffing > 0) {
+                    af[afn++] = 0; // no flags
+                    stuffing--;
+                }
+            }
+            memset(af + afn, 0xff, stuffing);
+            afn += stuffing;
+        }
+        if(afn > 0) {
+            af[0] = afn - 1;
+        }
+        p[3] = (afn > 0 ? 0x30 : 0x10) | nextCounter(pid);
+        memcpy(p + 4, af, afn);
+        uint32_t n = PACKET_SIZE - 4 - afn;
+        uint8_t *payload = p + 4 + afn;
+        // header bytes first, then data
+        while(n > 0) {
+            uint32_t k;
+            if(offset < hn) {
+                k = std::min(n, hn - offset);
+                memcpy(payload, h + offset, k);
+            } else {
+                k = std::min(n, total - offset);
+                memcpy(payload, data + (offset - hn), k);
+            }
+            payload += k;
+            offset += k;
+            n -= k;
+        }
+        output.commit(PACKET_SIZE);
+        first = false;
+    }
+}
+}
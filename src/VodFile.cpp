@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <spdlog/spdlog.h>
+#include "VodFile.hpp"
+#include "Endian.hpp"
+#include "Flv.hpp"
+#include "Rtmp.hpp"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace ms777 {
+constexpr uint8_t CODEC_AAC = 10;
+
+namespace {
+// unmapped once the file is out of the cache and no packet points into it
+struct Mapping {
+    void *addr{ nullptr };
+    std::size_t size{ 0 };
+
+    ~Mapping()
+    {
+        if(!addr) {
+            return;
+        }
+#if defined(_WIN32)
+        UnmapViewOfFile(addr);
+#else
+        munmap(addr, size);
+#endif
+    }
+};
+
+// fd is left open to watch the size where files can shrink under the mapping
+std::shared_ptr<Mapping> mapFile(const std::string &path, int &fd)
+{
+    auto m = std::make_shared<Mapping>();
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if(GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping) {
+            m->addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            m->size = static_cast<std::size_t>(size.QuadPart);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return nullptr;
+    }
+    // the recorder locks the files it is writing, only finished ones are served
+    if(flock(fd, LOCK_SH | LOCK_NB) != 0) {
+        SPDLOG_WARN("VOD file {}, still being recorded", path);
+        ::close(fd);
+        fd = -1;
+        return nullptr;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(addr != MAP_FAILED) {
+            m->addr = addr;
+            m->size = st.st_size;
+        }
+    }
+    if(!m->addr) {
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+    return m->addr ? m : nullptr;
+}
+}
+
+VodFile::~VodFile()
+{
+#if !defined(_WIN32)
+    if(fd_ >= 0) {
+        ::close(fd_);
+    }
+#endif
+}
+
+std::shared_ptr<VodFile> VodFile::open(const std::string &path)
+{
+    auto f = std::make_shared<VodFile>();
+    auto m = mapFile(path, f->fd_);
+    if(!m) {
+        SPDLOG_ERROR("VOD file {}, cannot map it", path);
+        return nullptr;
+    }
+    // slices address the mapping with 32 bit offsets
+    if(m->size > std::numeric_limits<uint32_t>::max()) {
+        SPDLOG_ERROR("VOD file {}, {} bytes is over the 4 GB limit", path, m->size);
+        return nullptr;
+    }
+    const uint8_t *data = static_cast<const uint8_t *>(m->addr);
+    uint32_t size = static_cast<uint32_t>(m->size);
+    uint32_t headerSize = 0;
+    if(size >= sizeof(flv::HEADER)) {
+        loadBE<uint32_t, 32>(data + 5, headerSize);
+    }
+    if(size < sizeof(flv::HEADER) || memcmp(data, flv::HEADER, 3) != 0 || headerSize < 9
+       || headerSize > size - flv::PREVIOUS_TAG_SIZE) {
+        SPDLOG_ERROR("VOD file {}, not an FLV file", path);
+        return nullptr;
+    }
+    f->path_ = path;
+    f->data_ = Frame::wrap(data, size, std::move(m));
+    f->first_ = headerSize + flv::PREVIOUS_TAG_SIZE;
+    f->buildIndex();
+    SPDLOG_INFO("VOD file {}, {} ms, {} key frames indexed", path, f->duration_, f->index_.size());
+    return f;
+}
+
+bool VodFile::intact() const
+{
+#if !defined(_WIN32)
+    // windows refuses to truncate a mapped file
+    struct stat st;
+    return fd_ < 0 || (fstat(fd_, &st) == 0 && static_cast<uint64_t>(st.st_size) >= data_->readableSize());
+#else
+    return true;
+#endif
+}
+
+bool VodFile::tag(uint32_t offset, Tag &t, uint32_t &next) const
+{
+    uint32_t size = data_->readableSize();
+    if(offset > size || size - offset < flv::TAG_HEADER_SIZE) {
+        return false;
+    }
+    const uint8_t *p = data_->readBuffer() + offset;
+    uint8_t extended;
+    loadBE<uint8_t, 8>(p, t.type);
+    t.type &= 0x1f; // filter and reserved bits
+    loadBE<uint32_t, 24>(p + 1, t.size);
+    loadBE<uint32_t, 24>(p + 4, t.timestamp);
+    loadBE<uint8_t, 8>(p + 7, extended);
+    t.timestamp |= uint32_t(extended) << 24;
+    if(t.size > size - offset - flv::TAG_HEADER_SIZE) {
+        // cut short, still being recorded or truncated
+        return false;
+    }
+    t.offset = offset + flv::TAG_HEADER_SIZE;
+    next = std::min<uint64_t>(uint64_t(t.offset) + t.size + flv::PREVIOUS_TAG_SIZE, size);
+    // the high nibble is the frame type of video and the codec of audio,
+    // only AAC audio has a packet type byte telling its sequence header
+    const uint8_t *body = p + flv::TAG_HEADER_SIZE;
+    uint8_t high = t.size > 0 ? body[0] >> 4 : 0;
+    t.keyFrame = t.type == rtmp::TYPE_VIDEO && high == 1;
+    bool aac = t.type == rtmp::TYPE_AUDIO && high == CODEC_AAC;
+    t.header = t.type == rtmp::TYPE_DATA || ((aac || t.keyFrame) && t.size >= 2 && body[1] == 0);
+    return true;
+}
+
+uint32_t VodFile::seek(uint32_t ms, uint32_t &timestamp) const
+{
+    auto it = std::upper_bound(index_.begin(), index_.end(), ms, [](uint32_t ms, const KeyFrame & k) {
+        return ms < k.timestamp;
+    });
+    if(it == index_.begin()) {
+        timestamp = 0;
+        return first_;
+    }
+    --it;
+    timestamp = it->timestamp;
+    return it->offset;
+}
+
+void VodFile::buildIndex()
+{
+    // one pass over the tag headers, the bodies are never touched
+    Tag t;
+    bool frames = false, video = false;
+    uint32_t next;
+    std::vector<KeyFrame> audio; // a seek point per second for files without video
+    for(uint32_t offset = first_; tag(offset, t, next); offset = next) {
+        if(t.header) {
+            if(!frames) {
+                headers_.push_back(offset);
+            }
+            continue;
+        }
+        if(t.type == rtmp::TYPE_VIDEO) {
+            video = true;
+            if(t.keyFrame) {
+                index_.push_back(KeyFrame{ t.timestamp, offset });
+            }
+        } else if(t.type == rtmp::TYPE_AUDIO && (audio.empty() || t.timestamp >= audio.back().timestamp + 1000)) {
+            audio.push_back(KeyFrame{ t.timestamp, offset });
+        }
+        frames = frames || t.type == rtmp::TYPE_VIDEO || t.type == rtmp::TYPE_AUDIO;
+        duration_ = std::max(duration_, t.timestamp);
+    }
+    if(!video) {
+        index_.swap(audio);
+    }
+}
+}
@@ -0,0 +1,56 @@
+#include "VodPlayer.hpp"
+#include "Rtmp.hpp"
+#include "Conf.hpp"
+
+namespace ms777 {
+VodPlayer::VodPlayer(std::shared_ptr<VodFile> file) : file_(std::move(file))
+{
+}
+
+void VodPlayer::seek(uint32_t ms, uint64_t now)
+{
+    header_ = 0;
+    offset_ = file_->seek(ms, base_);
+    clock_ = now;
+    ended_ = false;
+}
+
+std::shared_ptr<StreamPacket> VodPlayer::next(uint64_t now)
+{
+    VodFile::Tag t;
+    uint32_t next;
+    if(header_ < file_->headers().size()) {
+        file_->tag(file_->headers()[header_++], t, next);
+        return makePacket(t);
+    }
+    while(!ended_) {
+        if(!file_->tag(offset_, t, next)) {
+            ended_ = true;
+            break;
+        }
+        if(t.type != rtmp::TYPE_AUDIO && t.type != rtmp::TYPE_VIDEO && t.type != rtmp::TYPE_DATA) {
+            offset_ = next;
+            continue;
+        }
+        if(!t.header && t.timestamp > base_ && t.timestamp - base_ > now - clock_ + FLAGS_vod_buffer_time) {
+            return nullptr;
+        }
+        offset_ = next;
+        return makePacket(t);
+    }
+    return nullptr;
+}
+
+std::shared_ptr<StreamPacket> VodPlayer::makePacket(const VodFile::Tag &t)
+{
+    auto p = std::make_shared<StreamPacket>();
+    p->seq = ++seq_;
+    p->type = t.type;
+    p->cid = (t.type == rtmp::TYPE_VIDEO) ? rtmp::CID_VIDEO : rtmp::CID_AUDIO;
+    p->timestamp = t.timestamp;
+    p->keyFrame = t.keyFrame;
+    p->header = t.header;
+    p->payload = FrameSlice(file_->data(), t.offset, t.size);
+    return p;
+}
+}
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "ChunkDemuxer.hpp"
+#include "Rtmp.hpp"
+
+// Chunk streams a client may send, fed to the demuxer from memory:
+// xmake build ms777-test && xmake run ms777-test
+using namespace ms777;
+
+namespace {
+constexpr uint32_t CHUNK_SIZE = 8192;
+
+int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if(!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while(0)
+
+void putBE24(std::vector<uint8_t> &out, uint32_t v)
+{
+    out.push_back((v >> 16) & 0xff);
+    out.push_back((v >> 8) & 0xff);
+    out.push_back(v & 0xff);
+}
+
+std::vector<uint8_t> header0(uint32_t length, uint8_t type)
+{
+    std::vector<uint8_t> out{ (uint8_t)((rtmp::CHUNK_TYPE_0 << 6) | rtmp::CID_VIDEO) };
+    putBE24(out, 0);
+    putBE24(out, length);
+    out.push_back(type);
+    out.insert(out.end(), { 1, 0, 0, 0 });
+    return out;
+}
+
+std::vector<uint8_t> header1(uint32_t length, uint8_t type)
+{
+    std::vector<uint8_t> out{ (uint8_t)((rtmp::CHUNK_TYPE_1 << 6) | rtmp::CID_VIDEO) };
+    putBE24(out, 40);
+    putBE24(out, length);
+    out.push_back(type);
+    return out;
+}
+
+std::vector<uint8_t> header3()
+{
+    return { (uint8_t)((rtmp::CHUNK_TYPE_3 << 6) | rtmp::CID_VIDEO) };
+}
+
+ChunkDemuxer::Result decodeAll(ChunkDemuxer &demuxer, const std::vector<uint8_t> &data)
+{
+    uint32_t consumed = 0;
+    auto result = demuxer.decode(data.data(), data.size(), consumed);
+    CHECK(result == ChunkDemuxer::Result::ERROR || consumed == data.size());
+    return result;
+}
+
+// a chunk body read straight into the payload, as RtmpSession::doReadChunkPayload does
+ChunkDemuxer::Result readDirect(ChunkDemuxer &demuxer)
+{
+    uint32_t size = demuxer.pendingPayload();
+    CHECK(size == CHUNK_SIZE);
+    std::fill_n(demuxer.payloadBuffer(), size, 'v');
+    return demuxer.commitPayload(size);
+}
+
+void testWholeMessage()
+{
+    ChunkDemuxer demuxer;
+    demuxer.setChunkSize(CHUNK_SIZE);
+    CHECK(decodeAll(demuxer, header0(2 * CHUNK_SIZE, rtmp::TYPE_VIDEO)) == ChunkDemuxer::Result::CHUNK);
+    CHECK(readDirect(demuxer) == ChunkDemuxer::Result::CHUNK);
+    // repeating the length and type mid-message is allowed
+    CHECK(decodeAll(demuxer, header1(2 * CHUNK_SIZE, rtmp::TYPE_VIDEO)) == ChunkDemuxer::Result::CHUNK);
+    CHECK(readDirect(demuxer) == ChunkDemuxer::Result::MESSAGE);
+    CHECK(demuxer.message()->payload->readableSize() == 2 * CHUNK_SIZE);
+}
+
+// the length grows past the reservation made for the first chunk
+void testLengthChangeMidMessage()
+{
+    ChunkDemuxer demuxer;
+    demuxer.setChunkSize(CHUNK_SIZE);
+    CHECK(decodeAll(demuxer, header0(2 * CHUNK_SIZE, rtmp::TYPE_VIDEO)) == ChunkDemuxer::Result::CHUNK);
+    CHECK(readDirect(demuxer) == ChunkDemuxer::Result::CHUNK);
+    CHECK(decodeAll(demuxer, header1(1000000, rtmp::TYPE_VIDEO)) == ChunkDemuxer::Result::ERROR);
+}
+
+// the length shrinks below what already arrived
+void testLengthShrinkMidMessage()
+{
+    ChunkDemuxer demuxer;
+    demuxer.setChunkSize(CHUNK_SIZE);
+    CHECK(decodeAll(demuxer, header0(3 * CHUNK_SIZE, rtmp::TYPE_VIDEO)) == ChunkDemuxer::Result::CHUNK);
+    CHECK(readDirect(demuxer) == ChunkDemuxer::Result::CHUNK);
+    CHECK(decodeAll(demuxer, header3()) == ChunkDemuxer::Result::CHUNK);
+    CHECK(readDirect(demuxer) == ChunkDemuxer::Result::CHUNK);
+    CHECK(decodeAll(demuxer, header1(1000, rtmp::TYPE_VIDEO)) == ChunkDemuxer::Result::ERROR);
+}
+
+void testTypeChangeMidMessage()
+{
+    ChunkDemuxer demuxer;
+    demuxer.setChunkSize(CHUNK_SIZE);
+    CHECK(decodeAll(demuxer, header0(2 * CHUNK_SIZE, rtmp::TYPE_VIDEO)) == ChunkDemuxer::Result::CHUNK);
+    CHECK(readDirect(demuxer) == ChunkDemuxer::Result::CHUNK);
+    CHECK(decodeAll(demuxer, header0(2 * CHUNK_SIZE, rtmp::TYPE_AUDIO)) == ChunkDemuxer::Result::ERROR);
+}
+}
+
+int main()
+{
+    testWholeMessage();
+    testLengthChangeMidMessage();
+    testLengthShrinkMidMessage();
+    testTypeChangeMidMessage();
+    if(failures > 0) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
@@ -1,6 +1,6 @@
 #!/bin/bash
 #cd ../
-SUBDIRS="include src "
+SUBDIRS="include src bench bench/micro tests "
 FILETYPES="*.hpp *.cpp"
 ASTYLE="astyle -A8 -c -s4 -xV -xn -xt4 -w -Y -p -U -xe -k3 -W3 -j -xg "
 for d in ${SUBDIRS}
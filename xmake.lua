@@ -1,10 +1,19 @@
 add_rules("mode.debug", "mode.release")
-target("ms777")
-    set_kind("binary")
+
+-- xmake f --io_uring=y, off unless asked for: needs Boost >= 1.78 and liburing,
+-- older toolchains stop at an #error in src/Server.cpp instead of building a
+-- server that silently falls back to select() with epoll disabled
+option("io_uring")
+    set_default(false)
+    set_showmenu(true)
+    set_description("Use Asio's io_uring backend for socket I/O (Linux, Boost >= 1.78, liburing)")
+option_end()
+
+-- settings shared by the server and the load generator
+local function common()
     set_languages("c++17")
     set_warnings("all", "error")
     add_includedirs("include")
-    add_files("src/*.cpp")
     if is_plat("windows", "mingw", "msys") then
         add_defines("_WIN32_WINNT=0x0601")
         add_defines("SPDLOG_FMT_EXTERNAL", "SPDLOG_ACTIVE_LEVEL=SPDLOG_LEVEL_DEBUG")
@@ -15,6 +24,11 @@ target("ms777")
     end
     if is_plat("linux") then
         add_syslinks("pthread")
+        if has_config("io_uring") then
+            -- every translation unit must agree on the backend
+            add_defines("MS777_IO_URING", "BOOST_ASIO_HAS_IO_URING", "BOOST_ASIO_DISABLE_EPOLL")
+            add_links("uring")
+        end
     end
     if is_mode("debug") then
         add_defines("DEBUG")
@@ -29,3 +43,34 @@ target("ms777")
         add_mxflags("-fomit-frame-pointer")
         set_optimize("fastest")
     end
+end
+
+target("ms777")
+    set_kind("binary")
+    common()
+    add_files("src/*.cpp")
+
+-- load generator, reads CPU and memory from /proc: xmake build ms777-bench
+if is_plat("linux") then
+    target("ms777-bench")
+        set_kind("binary")
+        set_default(false)
+        common()
+        add_includedirs("bench")
+        add_files("bench/*.cpp", "src/*.cpp|main.cpp")
+end
+
+-- protocol microbenchmarks, needs Google Benchmark: xmake build ms777-microbench
+target("ms777-microbench")
+    set_kind("binary")
+    set_default(false)
+    common()
+    add_files("bench/micro/*.cpp", "src/*.cpp|main.cpp")
+    add_links("benchmark")
+
+-- protocol tests fed from memory, exit non-zero on failure: xmake build ms777-test && xmake run ms777-test
+target("ms777-test")
+    set_kind("binary")
+    set_default(false)
+    common()
+    add_files("tests/*.cpp", "src/*.cpp|main.cpp")